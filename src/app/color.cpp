@@ -35,8 +35,10 @@
 #include <QTimer>
 #include <QMessageBox>
 #include <QApplication>
+#include <QtConcurrent/QtConcurrent>
 
 #include "convertdialog.h"
+#include "profileregistry.h"
 
 void Editor::populateColorProfileMenu(QMenu *menu,
                                       Magick::ColorspaceType colorspace)
@@ -78,15 +80,22 @@ void Editor::selectDefaultColorProfile()
     if (menu->objectName() == QString("colorProfileRGBMenu")) {
         settings.setValue(QString("rgb_profile"),
                           action->data().toString());
+        brushColorProfile = Magick::Blob();
     } else if (menu->objectName() == QString("colorProfileCMYKMenu")) {
         settings.setValue(QString("cmyk_profile"),
                           action->data().toString());
     } else if (menu->objectName() == QString("colorProfileGRAYMenu")) {
         settings.setValue(QString("gray_profile"),
                           action->data().toString());
+    } else if (menu->objectName() == QString("colorProfileDisplayMenu")) {
+        settings.setValue(QString("display_profile"),
+                          action->data().toString());
     }
     settings.endGroup();
     settings.sync();
+
+    handleBrushColorProfile();
+    handleDisplayProfile();
 }
 
 void Editor::setDefaultColorProfiles(QMenu *menu)
@@ -104,6 +113,9 @@ void Editor::setDefaultColorProfiles(QMenu *menu)
         } else if (menu->objectName() == QString("colorProfileGRAYMenu")) {
             populateColorProfileMenu(menu,
                                      Magick::GRAYColorspace);
+        } else if (menu->objectName() == QString("colorProfileDisplayMenu")) {
+            populateColorProfileMenu(menu,
+                                     Magick::sRGBColorspace);
         }
     }
 
@@ -134,6 +146,15 @@ void Editor::setDefaultColorProfiles(QMenu *menu)
             setDefaultColorProfileFromTitle(menu,
                                             QString("ISO Coated v2 - GREY 1c - (built-in)"));
         }
+    } else if (menu->objectName() == QString("colorProfileDisplayMenu")) {
+        if (settings.value(QString("display_profile")).isValid()) {
+            setDefaultColorProfileFromFilename(menu,
+                                               settings.value(QString("display_profile"))
+                                               .toString());
+        } else {
+            setDefaultColorProfileFromTitle(menu,
+                                            QString("sRGB (built-in)"));
+        }
     }
 
     settings.endGroup();
@@ -181,18 +202,10 @@ Magick::Blob Editor::selectedDefaultColorProfileData(QMenu *menu)
         if (!action) { continue; }
         if (action->isChecked()) { filename =  action->data().toString(); }
     }
-    if (!filename.isEmpty()) {
-        try {
-            Magick::Image image;
-            image.read(filename.toStdString());
-            Magick::Blob profile;
-            image.write(&profile);
-            return profile;
-        }
-        catch(Magick::Error &error_ ) { emit errorMessage(error_.what()); }
-        catch(Magick::Warning &warn_ ) { emit warningMessage(warn_.what()); }
-    }
-    return Magick::Blob();
+    if (filename.isEmpty()) { return Magick::Blob(); }
+    Magick::Blob profile = ProfileRegistry::blob(filename);
+    if (profile.length()==0) { emit errorMessage(tr("Unable to read color profile %1").arg(filename)); }
+    return profile;
 }
 
 void Editor::populateColorIntentMenu()
@@ -273,6 +286,9 @@ void Editor::setDefaultColorIntent()
                       action->data().toInt());
     settings.endGroup();
     settings.sync();
+
+    handleBrushColorProfile();
+    handleDisplayProfile();
 }
 
 void Editor::loadDefaultColorIntent()
@@ -291,6 +307,67 @@ void Editor::loadDefaultColorIntent()
     settings.endGroup();
 }
 
+Common::RenderingIntent Editor::selectedColorIntent()
+{
+    for (int i=0;i<colorIntentMenu->actions().size();++i) {
+        QAction *action = colorIntentMenu->actions().at(i);
+        if (!action || !action->isChecked()) { continue; }
+        return static_cast<Common::RenderingIntent>(action->data().toInt());
+    }
+    return Common::PerceptualRenderingIntent;
+}
+
+void Editor::handleBrushColorProfile(View *view)
+{
+    // brush colors are picked in the default RGB profile
+    if (brushColorProfile.length()==0) {
+        brushColorProfile = selectedDefaultColorProfileData(colorProfileRGBMenu);
+    }
+    QList<View*> views;
+    if (view) { views << view; }
+    else {
+        QList<QMdiSubWindow*> list = mdi->subWindowList();
+        for (int i=0;i<list.size();++i) {
+            View *subView = qobject_cast<View*>(list.at(i)->widget());
+            if (subView) { views << subView; }
+        }
+    }
+    for (int i=0;i<views.size();++i) {
+        views.at(i)->setBrushColorProfile(brushColorProfile,
+                                          selectedColorIntent(),
+                                          blackPointAct->isChecked());
+    }
+}
+
+void Editor::handleDisplayProfile(View *view)
+{
+    // tiles are shown through canvas -> (proof) -> monitor
+    Magick::Blob monitor = selectedDefaultColorProfileData(colorProfileDisplayMenu);
+    Magick::Blob proof;
+    Magick::Blob gamut;
+    if (softProofAct->isChecked() || gamutWarningAct->isChecked()) {
+        Magick::Blob cmyk = selectedDefaultColorProfileData(colorProfileCMYKMenu);
+        if (softProofAct->isChecked()) { proof = cmyk; }
+        if (gamutWarningAct->isChecked()) { gamut = cmyk; }
+    }
+    QList<View*> views;
+    if (view) { views << view; }
+    else {
+        QList<QMdiSubWindow*> list = mdi->subWindowList();
+        for (int i=0;i<list.size();++i) {
+            View *subView = qobject_cast<View*>(list.at(i)->widget());
+            if (subView) { views << subView; }
+        }
+    }
+    for (int i=0;i<views.size();++i) {
+        views.at(i)->setDisplayProfile(monitor,
+                                       proof,
+                                       gamut,
+                                       selectedColorIntent(),
+                                       blackPointAct->isChecked());
+    }
+}
+
 void Editor::handleColorConvertRGB(bool ignoreColor, const QString &title)
 {
     handleColorConvert(ignoreColor,
@@ -335,6 +412,14 @@ void Editor::handleColorConvert(bool ignoreColor,
                                 const QString &title)
 {
     if (!getCurrentView()) { return; }
+    if (convertWatcher->isRunning()) {
+        emit statusMessage(tr("A color conversion is already running"));
+        return;
+    }
+    if (importStreams.values().contains(getCurrentView()->getCanvasID())) {
+        emit statusMessage(tr("Wait for the image to finish loading"));
+        return;
+    }
     if (getCurrentView()->getCanvas().colorSpace() == colorspace && !ignoreColor) {
         emit statusMessage(tr("Already the requested colorspace"));
         return;
@@ -355,22 +440,40 @@ void Editor::handleColorConvert(bool ignoreColor,
                                               profile,
                                               colorspace);
     int ret = dialog->exec();
+    Magick::Blob output;
     if (ret == QDialog::Accepted &&
         !dialog->getProfile().isEmpty())
     {
         qDebug() << "CONVERT USING" << dialog->getProfile();
-        Common::Canvas canvas = getCurrentView()->getCanvasProject();
-        canvas.image = Common::convertColorspace(canvas.image,
-                                                 canvas.profile,
-                                                 dialog->getProfile());
-        for (int i=0;i<canvas.layers.size();++i) {
-            canvas.layers[i].image= Common::convertColorspace(canvas.layers[i].image,
-                                                              canvas.profile,
-                                                              dialog->getProfile());
+
+        // read the profile once, every layer shares the same cached transform
+        output = ProfileRegistry::blob(dialog->getProfile());
+        if (output.length()==0) {
+            emit errorMessage(tr("Unable to read color profile %1").arg(dialog->getProfile()));
         }
-        canvas.profile = canvas.image.iccColorProfile();
-        getCurrentView()->updateCanvas(canvas);
-        updateTabTitle(getCurrentView());
+    }
+    if (output.length()>0) {
+        // canvas and layers are converted together in the background,
+        // the view is read-only until the result replaces its canvas
+        getCurrentView()->setReadOnly(true);
+        handleTabActivated(mdi->currentSubWindow());
+        convertWatcher->setProperty("canvasID", getCurrentView()->getCanvasID());
+        convertWatcher->setProperty("title", title);
+        convertProgress->setValue(0);
+        convertProgress->show();
+        emit statusMessage(tr("Converting %1 ...").arg(getCurrentView()->getCanvasProject(false).label));
+        ColorEngine::Progress progress = [this](int percent) {
+            QMetaObject::invokeMethod(this,
+                                      "handleColorConvertProgress",
+                                      Qt::QueuedConnection,
+                                      Q_ARG(int, percent));
+        };
+        convertWatcher->setFuture(QtConcurrent::run(&ColorEngine::convertCanvas,
+                                                    getCurrentView()->getCanvasProject(),
+                                                    output,
+                                                    selectedColorIntent(),
+                                                    blackPointAct->isChecked(),
+                                                    progress));
     }
 
     QTimer::singleShot(100,
@@ -378,6 +481,43 @@ void Editor::handleColorConvert(bool ignoreColor,
                        SLOT(deleteLater()));
 }
 
+void Editor::handleColorConvertProgress(int percent)
+{
+    if (!convertWatcher->isRunning()) { return; }
+    convertProgress->setValue(percent);
+}
+
+void Editor::handleColorConvertFinished()
+{
+    convertProgress->hide();
+    bool hasResult = convertWatcher->future().resultCount()>0;
+    Common::Canvas canvas;
+    if (hasResult) { canvas = convertWatcher->result(); }
+    convertWatcher->setFuture(QFuture<Common::Canvas>());
+
+    // the canvas may have been closed while converting
+    QString target = convertWatcher->property("canvasID").toString();
+    QList<Magick::Image> pending = pendingLayers.take(target);
+    QList<QMdiSubWindow*> list = mdi->subWindowList();
+    for (int i=0;i<list.size();++i) {
+        View *view = qobject_cast<View*>(list.at(i)->widget());
+        if (!view || view->getCanvasID() != target) { continue; }
+        view->setReadOnly(false);
+        if (hasResult) {
+            view->updateCanvas(canvas,
+                               convertWatcher->property("title").toString());
+            updateTabTitle(view);
+        }
+
+        // layers imported while converting
+        for (int y=0;y<pending.size();++y) { addLayerToView(pending.at(y), view); }
+        if (pending.size()>0) { view->scene()->update(); }
+        break;
+    }
+    handleTabActivated(mdi->currentSubWindow());
+    if (hasResult) { emit statusMessage(tr("Done")); }
+}
+
 void Editor::hasColorProfiles()
 {
     int rgbs = Common::getColorProfiles(Magick::sRGBColorspace).size();
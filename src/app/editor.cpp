@@ -42,6 +42,8 @@
 #include <QMdiSubWindow>
 #include <QVBoxLayout>
 #include <QTimer>
+#include <QThread>
+#include <QSharedPointer>
 
 #include <QMessageBox>
 #include <QImage>
@@ -49,12 +51,12 @@
 #include <QHeaderView>
 #include <QKeySequence>
 #include <QDebug>
-#include <QMimeDatabase>
-#include <QMimeType>
+#include <QtConcurrent/QtConcurrent>
 
 
 #include "newmediadialog.h"
 #include "convertdialog.h"
+#include "project.h"
 
 #ifdef WITH_FFMPEG
 #include "videodialog.h"
@@ -100,6 +102,8 @@ Editor::Editor(QWidget *parent)
     , colorProfileCMYKMenu(nullptr)
     , colorProfileGRAYMenu(nullptr)
     , colorIntentMenu(nullptr)
+    , codecMenu(nullptr)
+    , benchmarkAct(nullptr)
     , newButton(nullptr)
     , saveButton(nullptr)
     , layersTree(nullptr)
@@ -110,6 +114,18 @@ Editor::Editor(QWidget *parent)
     , brushDock(nullptr)
     , colorTriangle(nullptr)
     , colorPicker(nullptr)
+    , compactWatcher(nullptr)
+    , autosaveTimer(nullptr)
+    , autosavePool(nullptr)
+    , autosaveEncoders(nullptr)
+    , autosaveLock(nullptr)
+    , benchmarkWatcher(nullptr)
+    , convertWatcher(nullptr)
+    , convertProgress(nullptr)
+    , importer(nullptr)
+    , importProgress(nullptr)
+    , importCancel(nullptr)
+    , importTile(false)
 {
     setWindowTitle(qApp->applicationName());
     setAttribute(Qt::WA_QuitOnClose);
@@ -119,9 +135,42 @@ Editor::Editor(QWidget *parent)
     qRegisterMetaType<Magick::Drawable>("Magick::Drawable");
     qRegisterMetaType<Magick::Geometry>("Magick::Geometry");
 
+    // project files are compacted in the background after saving
+    compactWatcher = new QFutureWatcher<Common::Canvas>(this);
+    connect(compactWatcher, SIGNAL(finished()),
+            this, SLOT(handleProjectCompacted()));
+
+    // autosave snapshots are written one at a time in the background
+    autosavePool = new QThreadPool(this);
+    autosavePool->setMaxThreadCount(1);
+    autosaveEncoders = new QThreadPool(this);
+    autosaveEncoders->setMaxThreadCount(qMax(1, QThread::idealThreadCount()/2));
+    autosaveLock = new QLockFile(Project::autosaveLockFile(QCoreApplication::applicationPid()));
+    autosaveLock->setStaleLockTime(0);
+    if (!autosaveLock->tryLock(0)) { qWarning() << "failed to lock autosave folder"; }
+    autosaveTimer = new QTimer(this);
+    connect(autosaveTimer, SIGNAL(timeout()),
+            this, SLOT(handleAutosave()));
+
+    // images are decoded (and converted) in the background
+    importer = new Importer(this);
+
+    benchmarkWatcher = new QFutureWatcher<QList<Project::CodecResult> >(this);
+    connect(benchmarkWatcher, SIGNAL(finished()),
+            this, SLOT(handleCodecBenchmarkFinished()));
+
+    // color conversions run on the thread pool, the result replaces the canvas
+    convertWatcher = new QFutureWatcher<Common::Canvas>(this);
+    connect(convertWatcher, SIGNAL(finished()),
+            this, SLOT(handleColorConvertFinished()));
+
     setupUI();
     loadSettings();
 
+    QTimer::singleShot(0,
+                       this,
+                       SLOT(handleAutosaveRecovery()));
+
 #ifdef QT_DEBUG
     qDebug() << "color profile path" << Common::getColorProfilesPath();
     qDebug() << "rgb color profiles" << Common::getColorProfiles(Magick::sRGBColorspace);
@@ -153,6 +202,13 @@ Editor::Editor(QWidget *parent)
 Editor::~Editor()
 {
     saveSettings();
+
+    // clean exit, autosaves are only needed after a crash
+    autosaveTimer->stop();
+    autosavePool->waitForDone();
+    convertWatcher->waitForFinished();
+    cleanupAutosave(true);
+    delete autosaveLock;
 }
 
 View *Editor::getCurrentView()
@@ -178,6 +234,12 @@ void Editor::saveSettings()
                       Common::getDiskResource());
     settings.setValue("memory_limit",
                       Common::getMemoryResource());
+    settings.setValue("history_limit",
+                      History::getMemoryLimit());
+    settings.setValue("autosave",
+                      autosaveTimer->isActive()?autosaveTimer->interval()/60000:0);
+    settings.setValue("project_codec",
+                      selectedProjectCodec());
     settings.endGroup();
 
     settings.beginGroup("gui");
@@ -200,8 +262,14 @@ void Editor::saveSettings()
                       selectedDefaultColorProfile(colorProfileCMYKMenu));
     settings.setValue(QString("gray_profile"),
                       selectedDefaultColorProfile(colorProfileGRAYMenu));
+    settings.setValue(QString("display_profile"),
+                      selectedDefaultColorProfile(colorProfileDisplayMenu));
     settings.setValue(QString("blackpoint"),
                       blackPointAct->isChecked());
+    settings.setValue(QString("soft_proof"),
+                      softProofAct->isChecked());
+    settings.setValue(QString("gamut_warning"),
+                      gamutWarningAct->isChecked());
     settings.endGroup();
 }
 
@@ -215,6 +283,18 @@ void Editor::loadSettings()
                             .value("disk_limit", 0).toInt());
     Common::setMemoryResource(settings
                               .value("memory_limit", 8).toInt());
+    History::setMemoryLimit(settings
+                            .value("history_limit",
+                                   HISTORY_MEMORY_LIMIT).toInt());
+    int autosave = settings.value("autosave",
+                                  CYAN_PROJECT_AUTOSAVE).toInt();
+    if (autosave>0) { autosaveTimer->start(autosave*60000); }
+    int codec = settings.value("project_codec",
+                               Project::FastCodec).toInt();
+    for (int i=0;i<codecMenu->actions().size();++i) {
+        QAction *action = codecMenu->actions().at(i);
+        action->setChecked(action->data().toInt() == codec);
+    }
     settings.endGroup();
 
     settings.beginGroup("gui");
@@ -245,26 +325,49 @@ void Editor::loadSettings()
     setDefaultColorProfiles(colorProfileRGBMenu);
     setDefaultColorProfiles(colorProfileCMYKMenu);
     setDefaultColorProfiles(colorProfileGRAYMenu);
+    setDefaultColorProfiles(colorProfileDisplayMenu);
     loadDefaultColorIntent();
     settings.beginGroup(QString("color"));
     blackPointAct->setChecked(settings.value(QString("blackpoint"),
                                              true)
                               .toBool());
+    softProofAct->setChecked(settings.value(QString("soft_proof"),
+                                            false)
+                             .toBool());
+    gamutWarningAct->setChecked(settings.value(QString("gamut_warning"),
+                                               false)
+                                .toBool());
     settings.endGroup();
 
     // quit if no color profiles are available
     hasColorProfiles();
 }
 
-void Editor::loadProject(const QString &filename)
+bool Editor::loadProject(const QString &filename)
 {
-    if (filename.isEmpty()) { return; }
-    QFileInfo fileInfo(filename);
-    if (fileInfo.suffix().toLower() != "miff") { return; }
-    if (Common::isValidCanvas(filename)) {
-        Common::Canvas canvas = Common::readCanvas(filename);
-        newTab(canvas);
+    if (filename.isEmpty()) { return false; }
+
+    // classified once, projects only need the header
+    Sniffer::Result result = Sniffer::classify(filename);
+    if (result.type == Sniffer::ProjectFile) {
+        emit statusMessage(tr("Loading project %1 (%2 layers)")
+                           .arg(filename)
+                           .arg(result.summary.layerCount));
+        // layers are allocated off the GUI thread, tiles load lazily
+        QFutureWatcher<Common::Canvas> *watcher = new QFutureWatcher<Common::Canvas>(this);
+        connect(watcher, SIGNAL(finished()),
+                this, SLOT(handleProjectLoaded()));
+        watcher->setFuture(QtConcurrent::run(&Project::read,
+                                             filename,
+                                             true));
+        return true;
     }
+    if (result.type != Sniffer::CanvasFile) { return false; }
+
+    emit statusMessage(tr("Loading canvas %1").arg(filename));
+    Common::Canvas canvas = Common::readCanvas(filename);
+    newTab(canvas);
+    return true;
 }
 
 void Editor::saveProject(const QString &filename)
@@ -272,7 +375,41 @@ void Editor::saveProject(const QString &filename)
     if (filename.isEmpty() || !getCurrentView()) { return; }
     qDebug() << "save project" << filename;
 
-    if (Common::writeCanvas(getCurrentView()->getCanvasProject(), filename)) {
+    bool saved = false;
+    QFileInfo fileInfo(filename);
+    if (fileInfo.suffix().toLower() == "miff") {
+        saved = Common::writeCanvas(getCurrentView()->getCanvasProject(),
+                                    filename,
+                                    Project::codecCompression(selectedProjectCodec()));
+    } else {
+        // autosaves copy raw chunks from the current project file, which
+        // is about to be replaced by this save and the compaction after it
+        autosavePool->waitForDone();
+
+        // the project file may be replaced by a running compaction
+        if (compactWatcher->isRunning()) {
+            compactWatcher->waitForFinished();
+            handleProjectCompacted();
+        }
+
+        // only changed tiles are written, the rest is reused or copied
+        // from the current project file
+        Common::Canvas canvas = getCurrentView()->getCanvasProject(false);
+        getCurrentView()->releaseProjectFile();
+        saved = Project::write(&canvas,
+                               filename,
+                               selectedProjectCodec());
+        if (!saved) { getCurrentView()->restoreProjectFile(); }
+        if (saved) {
+            getCurrentView()->setProjectFile(canvas);
+            if (Project::needsCompaction(canvas)) {
+                emit statusMessage(tr("Compacting project %1 ...").arg(filename));
+                compactWatcher->setFuture(QtConcurrent::run(&Project::compact,
+                                                            canvas));
+            }
+        }
+    }
+    if (saved) {
         /*Common::Canvas canvas = Common::readCanvas(filename);
         qDebug() << "====> canvas" << canvas.label << canvas.layers.size();
         newTab(canvas);
@@ -293,92 +430,140 @@ void Editor::saveImage(const QString &filename)
 void Editor::loadImage(const QString &filename)
 {
     if (filename.isEmpty()) { return; }
-    if (Common::isValidCanvas(filename)) {
-        emit statusMessage(tr("Loading canvas %1").arg(filename));
-        loadProject(filename);
-        emit statusMessage(tr("Done"));
-    } else {
-        qDebug() << "HAS LAYERS?" << Common::hasLayers(filename);
-        emit statusMessage(tr("Loading image %1").arg(filename));
-        readImage(filename);
+    if (loadProject(filename)) {
         emit statusMessage(tr("Done"));
+        return;
     }
+    emit statusMessage(tr("Loading image %1").arg(filename));
+    readImage(filename);
 }
 
 void Editor::readImage(Magick::Blob blob,
                        const QString &filename)
 {
-    Magick::Image image;
-    image.quiet(false);
+    // the tab is created once the importer is done
+    importer->import(filename, blob);
+}
 
-    try {
-        if (blob.length()>0) {
-            image.read(blob);
-        } else if (!filename.isEmpty()) {
-            image.read(filename.toStdString());
+void Editor::handleImportProfile(int id,
+                                 int colorspace)
+{
+    QString defPro;
+    switch(colorspace) {
+    case Magick::CMYKColorspace:
+        defPro = selectedDefaultColorProfile(colorProfileCMYKMenu);
+        break;
+    case Magick::GRAYColorspace:
+        defPro = selectedDefaultColorProfile(colorProfileGRAYMenu);
+        break;
+    default:
+        defPro = selectedDefaultColorProfile(colorProfileRGBMenu);
+    }
+
+    // not modal, the image is still decoding
+    ConvertDialog *dialog = new ConvertDialog(this,
+                                              tr("Assign Color Profile"),
+                                              defPro,
+                                              static_cast<Magick::ColorspaceType>(colorspace));
+    dialog->setProperty("importID", id);
+    connect(dialog, SIGNAL(finished(int)),
+            this, SLOT(handleImportProfileDialog(int)));
+    dialog->open();
+}
+
+void Editor::handleImportProfileDialog(int result)
+{
+    ConvertDialog *dialog = qobject_cast<ConvertDialog*>(sender());
+    if (!dialog) { return; }
+    int id = dialog->property("importID").toInt();
+    if (result == QDialog::Accepted) { importer->setProfile(id, dialog->getProfile()); }
+    else { importer->cancel(id); }
+    QTimer::singleShot(100,
+                       dialog,
+                       SLOT(deleteLater()));
+}
+
+void Editor::handleImported(int id,
+                            Magick::Image image,
+                            const QString &target)
+{
+    if (target.isEmpty()) {
+        // the importer fills streamed images into this canvas
+        View *view = newTab(image);
+        if (view && importer->isStreaming(id)) {
+            importStreams.insert(id, view->getCanvasID());
         }
+        return;
+    }
+
+    // add as layer, if the canvas is still open
+    QList<QMdiSubWindow*> list = mdi->subWindowList();
+    for (int i=0;i<list.size();++i) {
+        View *view = qobject_cast<View*>(list.at(i)->widget());
+        if (!view || view->getCanvasID() != target) { continue; }
+        addLayerToView(image, view);
+        view->scene()->update();
+        break;
     }
-    catch(Magick::Error &error_ ) {
-        emit errorMessage(error_.what());
+}
+
+void Editor::handleImportPreview(int id,
+                                 const QRect &rect,
+                                 const QImage &preview)
+{
+    if (!importStreams.contains(id)) { return; }
+    QList<QMdiSubWindow*> list = mdi->subWindowList();
+    for (int i=0;i<list.size();++i) {
+        View *view = qobject_cast<View*>(list.at(i)->widget());
+        if (!view || view->getCanvasID() != importStreams.value(id)) { continue; }
+        view->setLayerPreview(0, rect, preview);
         return;
     }
-    catch(Magick::Warning &warn_ ) { emit warningMessage(warn_.what()); }
+}
 
-    try {
-        image.magick("MIFF");
-        image.fileName(filename.toStdString());
-        if (image.label().empty()) {
-            QFileInfo fileInfo(filename);
-            image.label(fileInfo.baseName().toStdString());
-        }
+void Editor::handleImportBand(int id,
+                              const QRect &rect,
+                              Magick::Image pixels)
+{
+    if (!importStreams.contains(id)) { return; }
+    QList<QMdiSubWindow*> list = mdi->subWindowList();
+    for (int i=0;i<list.size();++i) {
+        View *view = qobject_cast<View*>(list.at(i)->widget());
+        if (!view || view->getCanvasID() != importStreams.value(id)) { continue; }
+        view->setLayerPixels(0, rect, pixels);
+        return;
+    }
+    importer->cancel(id); // canvas was closed
+}
 
-        if (image.iccColorProfile().length()==0) {
-            QString defPro;
-            switch(image.colorSpace()) {
-            case Magick::CMYKColorspace:
-                defPro = selectedDefaultColorProfile(colorProfileCMYKMenu);
-                break;
-            case Magick::GRAYColorspace:
-                defPro = selectedDefaultColorProfile(colorProfileGRAYMenu);
-                break;
-            default:
-                defPro = selectedDefaultColorProfile(colorProfileRGBMenu);
-            }
-            ConvertDialog *dialog = new ConvertDialog(this,
-                                                      tr("Assign Color Profile"),
-                                                      defPro,
-                                                      image.colorSpace());
-            int ret = dialog->exec();
-            if (ret == QDialog::Accepted &&
-                !dialog->getProfile().isEmpty())
-            {
-                Magick::Blob profile;
-                Magick::Image input;
-                input.read(dialog->getProfile().toStdString());
-                input.write(&profile);
-                image = Common::convertColorspace(image,
-                                                  Magick::Blob(),
-                                                  profile);
-                if (image.columns()>0 &&
-                    image.rows()>0 &&
-                    image.iccColorProfile().length()>0)
-                {
-                    newTab(image);
-                }
-            }
-            QTimer::singleShot(100,
-                               dialog,
-                               SLOT(deleteLater()));
-        } else {
-            if (image.columns()>0 &&
-                image.rows()>0)
-            {
-                newTab(image);
-            }
-        }
+void Editor::handleImportStreamFinished(int id,
+                                        const QImage &overview)
+{
+    QString canvasID = importStreams.take(id);
+    if (canvasID.isEmpty() || overview.isNull()) { return; }
+    QList<QMdiSubWindow*> list = mdi->subWindowList();
+    for (int i=0;i<list.size();++i) {
+        View *view = qobject_cast<View*>(list.at(i)->widget());
+        if (!view || view->getCanvasID() != canvasID) { continue; }
+        view->setLayerThumbnail(0, overview);
+        layersTree->clear();
+        layersTree->handleTabActivated(mdi->currentSubWindow());
+        break;
     }
-    catch(Magick::Error &error_ ) { emit errorMessage(error_.what()); }
-    catch(Magick::Warning &warn_ ) { emit warningMessage(warn_.what()); }
+}
+
+void Editor::handleImportProgress(int percent,
+                                  int jobs)
+{
+    if (jobs==0) {
+        emit statusMessage(tr("Done"));
+        if (importTile) { mdi->tileSubWindows(); }
+        importTile = false;
+    }
+    importProgress->setVisible(jobs>0);
+    importCancel->setVisible(jobs>0);
+    importProgress->setValue(percent);
+    importProgress->setFormat(jobs>1 ? tr("%p% (%1 images)").arg(jobs) : QString("%p%"));
 }
 
 void Editor::readImage(const QString &filename)
@@ -391,6 +576,13 @@ void Editor::writeImage(const QString &filename)
 {
     if (filename.isEmpty() || !getCurrentView()) { return; }
 
+    if (BandWriter::supports(filename)) {
+        if (!BandWriter::write(getCurrentView()->getCanvasProject(), filename)) {
+            emit errorMessage(tr("Failed to write %1").arg(filename));
+        }
+        return;
+    }
+
     Magick::Image image = common.renderCanvasToImage(getCurrentView()->getCanvasProject());
     // TODO: add options for file format
     try {
@@ -548,12 +740,112 @@ void Editor::saveProjectDialog()
     QString filename = QFileDialog::getSaveFileName(this,
                                                     tr("Save Project"),
                                                     QDir::homePath(),
-                                                    tr("Project Files (*.miff)"));
-    if (!filename.endsWith(".miff",
-                           Qt::CaseInsensitive)) { filename.append(".miff"); }
+                                                    tr("Project Files (*.%1);;Legacy Project Files (*.miff)")
+                                                    .arg(CYAN_PROJECT_SUFFIX));
+    if (filename.isEmpty()) { return; }
+    if (!filename.endsWith(QString(".%1").arg(CYAN_PROJECT_SUFFIX),
+                           Qt::CaseInsensitive) &&
+        !filename.endsWith(".miff",
+                           Qt::CaseInsensitive)) {
+        filename.append(QString(".%1").arg(CYAN_PROJECT_SUFFIX));
+    }
+    saveProject(filename);
+}
+
+void Editor::handleSaveProject()
+{
+    if (!getCurrentView()) { return; }
+    QString filename = getCurrentView()->getCanvasProject(false).filename;
+    if (filename.isEmpty() || !Project::isProject(filename)) {
+        saveProjectDialog();
+        return;
+    }
     saveProject(filename);
 }
 
+void Editor::handleProjectLoaded()
+{
+    QFutureWatcher<Common::Canvas> *watcher = dynamic_cast<QFutureWatcher<Common::Canvas>*>(sender());
+    if (!watcher) { return; }
+    watcher->deleteLater();
+    if (watcher->future().resultCount()==0) { return; }
+    Common::Canvas canvas = watcher->result();
+    if (!canvas.error.isEmpty()) {
+        emit errorMessage(canvas.error);
+        return;
+    }
+    newTab(canvas);
+}
+
+void Editor::handleProjectCompacted()
+{
+    if (!compactWatcher->isFinished() ||
+        compactWatcher->future().resultCount()==0) { return; }
+    Common::Canvas canvas = compactWatcher->result();
+    compactWatcher->setFuture(QFuture<Common::Canvas>());
+    if (!canvas.error.isEmpty()) {
+        emit warningMessage(canvas.error);
+        return;
+    }
+
+    // the view lets go of the project file while it's replaced
+    View *target = nullptr;
+    QList<QMdiSubWindow*> list = mdi->subWindowList();
+    for (int i=0;i<list.size();++i) {
+        View *view = qobject_cast<View*>(list.at(i)->widget());
+        if (!view || view->getCanvasID() != canvas.timestamp) { continue; }
+        target = view;
+        break;
+    }
+    autosavePool->waitForDone();
+    if (target) { target->releaseProjectFile(); }
+    if (!Project::commitCompaction(canvas.filename)) {
+        if (target) { target->restoreProjectFile(); }
+        emit warningMessage(tr("Failed to compact project %1").arg(canvas.filename));
+        return;
+    }
+    if (target) { target->setProjectFile(canvas, true); }
+    emit statusMessage(tr("Done"));
+}
+
+Project::Codec Editor::selectedProjectCodec()
+{
+    for (int i=0;i<codecMenu->actions().size();++i) {
+        QAction *action = codecMenu->actions().at(i);
+        if (!action || !action->isChecked()) { continue; }
+        return static_cast<Project::Codec>(action->data().toInt());
+    }
+    return Project::FastCodec;
+}
+
+void Editor::handleCodecBenchmark()
+{
+    if (!getCurrentView() || benchmarkWatcher->isRunning()) { return; }
+    emit statusMessage(tr("Benchmarking project compression ..."));
+    benchmarkWatcher->setFuture(QtConcurrent::run(&Project::benchmark,
+                                                  getCurrentView()->getCanvasProject()));
+}
+
+void Editor::handleCodecBenchmarkFinished()
+{
+    if (benchmarkWatcher->future().resultCount()==0) { return; }
+    QList<Project::CodecResult> results = benchmarkWatcher->result();
+    QString report;
+    for (int i=0;i<results.size();++i) {
+        const Project::CodecResult &result = results.at(i);
+        double speed = result.rawBytes/1048576.0/qMax<qint64>(1, result.msecs)*1000.0;
+        double ratio = result.bytes>0 ? static_cast<double>(result.rawBytes)/result.bytes : 0.0;
+        report.append(tr("%1: %2 MB/s, ratio %3:1\n")
+                      .arg(Project::codecName(result.codec))
+                      .arg(speed, 0, 'f', 1)
+                      .arg(ratio, 0, 'f', 2));
+    }
+    emit statusMessage(tr("Done"));
+    QMessageBox::information(this,
+                             tr("Project compression"),
+                             report);
+}
+
 void Editor::saveImageDialog()
 {
     if (!getCurrentView()) { return; }
@@ -561,7 +853,7 @@ void Editor::saveImageDialog()
                                                     tr("Save Image"),
                                                     QString("%1/%2")
                                                     .arg(QDir::homePath())
-                                                    .arg(getCurrentView()->getCanvasProject().label),
+                                                    .arg(getCurrentView()->getCanvasProject(false).label),
                                                     tr("Image files (%1)")
                                                     .arg(common.supportedWriteFormats()));
     if (filename.isEmpty()) { return; }
@@ -585,9 +877,9 @@ void Editor::saveLayerDialog()
                              tr("No layer selected"));
         return;
     }
-    QString label = getCurrentView()->getCanvasProject().label;
-    if (!getCurrentView()->getCanvasProject().layers[layerItem->getLayerID()].label.isEmpty()) {
-        label = getCurrentView()->getCanvasProject().layers[layerItem->getLayerID()].label;
+    QString label = getCurrentView()->getCanvasProject(false).label;
+    if (!getCurrentView()->getCanvasProject(false).layers[layerItem->getLayerID()].label.isEmpty()) {
+        label = getCurrentView()->getCanvasProject(false).layers[layerItem->getLayerID()].label;
     }
     QString filename = QFileDialog::getSaveFileName(this,
                                                     tr("Save Image"),
@@ -616,19 +908,18 @@ void Editor::loadImageDialog()
                                                     .arg(common.supportedReadFormats()));
     if (filename.isEmpty()) { return; }
 
-    QMimeDatabase db;
-    QMimeType type = db.mimeTypeForFile(filename);
+    Sniffer::FileType type = Sniffer::classify(filename).type;
 #ifdef WITH_FFMPEG
-    if (type.name().startsWith(QString("audio"))) {
+    if (type == Sniffer::AudioFile) {
         readAudio(filename);
-    } else if(type.name().startsWith(QString("video"))) {
+    } else if(type == Sniffer::VideoFile) {
         readVideo(filename);
     } else {
         loadImage(filename);
     }
 #else
-    if (type.name().startsWith(QString("audio")) ||
-        type.name().startsWith(QString("video"))) { return; }
+    if (type == Sniffer::AudioFile ||
+        type == Sniffer::VideoFile) { return; }
     loadImage(filename);
 #endif
 }
@@ -650,7 +941,7 @@ void Editor::newLayerDialog()
                                                 tr("New Layer"),
                                                 Common::newLayerDialogType,
                                                 getCurrentView()->getCanvas().colorSpace(),
-                                                getCurrentView()->getCanvasProject().profile,
+                                                getCurrentView()->getCanvasProject(false).profile,
                                                 getCurrentView()->getCanvasSize());
     int res =  dialog->exec();
     if (res == QDialog::Accepted) {
@@ -682,6 +973,7 @@ void Editor::connectView(View *view)
     connect(view, SIGNAL(warningMessage(QString)), this, SLOT(handleStatus(QString)));
     connect(view, SIGNAL(viewClosed()), this, SLOT(handleViewClosed()));
     connect(view, SIGNAL(updatedLayers()), this, SLOT(handleLayersUpdated()));
+    connect(view, SIGNAL(updatedHistory()), this, SLOT(handleHistoryUpdated()));
     connect(view, SIGNAL(switchMoveTool()), this, SLOT(handleSwitchMoveTool()));
     connect(view, SIGNAL(updatedBrushStroke(int)), this, SLOT(handleUpdateBrushSize(int)));
     connect(view, SIGNAL(openImages(QList<QUrl>)), this, SLOT(handleOpenImages(QList<QUrl>)));
@@ -753,6 +1045,113 @@ void Editor::handleViewClosed()
     qDebug() << "view closed";
     layersTree->clear();
     layersTree->handleTabActivated(mdi->currentSubWindow());
+    QTimer::singleShot(0,
+                       this,
+                       SLOT(cleanupAutosave()));
+}
+
+void Editor::handleAutosave()
+{
+    if (compactWatcher->isRunning()) { return; }
+    QList<QMdiSubWindow*> list = mdi->subWindowList();
+    for (int i=0;i<list.size();++i) {
+        View *view = qobject_cast<View*>(list.at(i)->widget());
+        if (!view) { continue; }
+        QString id = view->getCanvasID();
+        if (id.isEmpty() || view->getRevision()==0) { continue; }
+        if (autosaveRevisions.value(id, -1) == view->getRevision()) { continue; }
+        if (autosaveJobs.contains(id) && autosaveJobs[id].isRunning()) { continue; }
+
+        // only tiles changed since the last save are copied
+        autosaveRevisions[id] = view->getRevision();
+        Project::Tiles tiles;
+        Common::Canvas canvas = Project::snapshot(view->getCanvasProject(false),
+                                                  &tiles);
+        autosaveJobs[id] = QtConcurrent::run(autosavePool,
+                                             &Project::autosave,
+                                             canvas,
+                                             tiles,
+                                             QString("%1/%2.%3")
+                                             .arg(Project::autosavePath(QCoreApplication::applicationPid()))
+                                             .arg(id)
+                                             .arg(CYAN_PROJECT_SUFFIX),
+                                             autosaveEncoders);
+    }
+}
+
+void Editor::handleAutosaveRecovery()
+{
+    // folders of instances that are gone, running instances keep theirs locked
+    QDir dir(Project::autosavePath());
+    QStringList instances = dir.entryList(QDir::Dirs|QDir::NoDotAndDotDot);
+    QList<QSharedPointer<QLockFile> > locks;
+    QStringList folders;
+    QStringList files;
+    for (int i=0;i<instances.size();++i) {
+        bool isPid = false;
+        qint64 pid = instances.at(i).toLongLong(&isPid);
+        if (!isPid || pid == QCoreApplication::applicationPid()) { continue; }
+        QSharedPointer<QLockFile> lock(new QLockFile(Project::autosaveLockFile(pid)));
+        lock->setStaleLockTime(0);
+        if (!lock->tryLock(0)) { continue; }
+        locks.append(lock);
+        QDir instance(dir.absoluteFilePath(instances.at(i)));
+        folders << instance.absolutePath();
+        QStringList saved = instance.entryList(QStringList() << QString("*.%1").arg(CYAN_PROJECT_SUFFIX),
+                                               QDir::Files);
+        for (int y=0;y<saved.size();++y) { files << instance.absoluteFilePath(saved.at(y)); }
+    }
+
+    int ret = QMessageBox::No;
+    if (files.size()>0) {
+        ret = QMessageBox::question(this,
+                                    tr("Recover projects"),
+                                    tr("Found %1 autosaved project(s) from a previous session."
+                                       " Do you want to recover them?").arg(files.size()),
+                                    QMessageBox::Yes|QMessageBox::No);
+    }
+    for (int i=0;i<files.size() && ret == QMessageBox::Yes;++i) {
+        Common::Canvas canvas = Project::read(files.at(i), false);
+        if (canvas.error.isEmpty()) {
+            // recovered projects are unsaved
+            canvas.filename.clear();
+            QMutableMapIterator<int, Common::Layer> layers(canvas.layers);
+            while (layers.hasNext()) {
+                layers.next();
+                Project::markDirty(&layers.value());
+            }
+            newTab(canvas);
+        } else { emit errorMessage(canvas.error); }
+    }
+
+    // the locks are released (and removed) once the folders are gone
+    for (int i=0;i<folders.size();++i) { QDir(folders.at(i)).removeRecursively(); }
+}
+
+void Editor::cleanupAutosave(bool all)
+{
+    // remove autosaves of closed views
+    QStringList ids;
+    if (!all) {
+        QList<QMdiSubWindow*> list = mdi->subWindowList();
+        for (int i=0;i<list.size();++i) {
+            View *view = qobject_cast<View*>(list.at(i)->widget());
+            if (view) { ids << view->getCanvasID(); }
+        }
+    }
+    // only our own folder, other instances may be running
+    QDir dir(Project::autosavePath(QCoreApplication::applicationPid()));
+    QStringList files = dir.entryList(QStringList() << QString("*.%1").arg(CYAN_PROJECT_SUFFIX),
+                                      QDir::Files);
+    for (int i=0;i<files.size();++i) {
+        QString id = QFileInfo(files.at(i)).completeBaseName();
+        if (ids.contains(id)) { continue; }
+        if (autosaveJobs.contains(id) && autosaveJobs[id].isRunning()) { continue; }
+        QFile::remove(dir.absoluteFilePath(files.at(i)));
+        autosaveJobs.remove(id);
+        autosaveRevisions.remove(id);
+    }
+    if (all) { dir.removeRecursively(); }
 }
 
 
@@ -779,35 +1178,30 @@ void Editor::handleOpenImages(const QList<QUrl> &urls)
     if (urls.size()==0) { return; }
     for (int i=0;i<urls.size();++i) {
         QString filename = urls.at(i).toLocalFile();
-        QMimeDatabase db;
-        QMimeType type = db.mimeTypeForFile(filename);
+        Sniffer::FileType type = Sniffer::classify(filename).type;
+        if (type == Sniffer::UnknownFile) { continue; }
 #ifdef WITH_FFMPEG
-        if (type.name().startsWith(QString("audio"))) { // try to get "coverart" from audio
+        if (type == Sniffer::AudioFile) { // try to get "coverart" from audio
             readAudio(filename);
-        } else if (type.name().startsWith(QString("video"))) { // get frame from video
+        } else if (type == Sniffer::VideoFile) { // get frame from video
             readVideo(filename);
         } else { // "regular" image
-            if (common.isValidCanvas(filename)) { loadProject(filename); }
-            else { readImage(filename); }
+            if (!loadProject(filename)) { readImage(filename); }
         }
 #else
-        if (type.name().startsWith(QString("audio")) ||
-            type.name().startsWith(QString("video"))) { continue; }
-        if (common.isValidCanvas(filename)) { loadProject(filename); }
-        else { readImage(filename); }
+        if (type == Sniffer::AudioFile ||
+            type == Sniffer::VideoFile) { continue; }
+        if (!loadProject(filename)) { readImage(filename); }
 #endif
     }
+
+    // tile once the importer is done
     if (urls.size()>1) {
-        mdi->tileSubWindows();
+        if (importer->isRunning()) { importTile = true; }
+        else { mdi->tileSubWindows(); }
     }
 }
 
-
-
-
-
-
-
 void Editor::handleOpenLayers(const QList<QUrl> &urls)
 {
     View *view = qobject_cast<View*>(sender());
@@ -818,31 +1212,39 @@ void Editor::handleOpenLayers(const QList<QUrl> &urls)
     for (int i=0;i<urls.size();++i) {
         QString filename = urls.at(i).toLocalFile();
 
-        QMimeDatabase db;
-        QMimeType type = db.mimeTypeForFile(urls.at(i).toString());
+        Sniffer::FileType type = Sniffer::classify(filename).type;
+        if (type == Sniffer::UnknownFile ||
+            type == Sniffer::ProjectFile ||
+            type == Sniffer::CanvasFile) { continue; }
         Magick::Image image;
 
         try {
 #ifdef WITH_FFMPEG
-            if (type.name().startsWith(QString("audio"))) { // try to get "coverart" from audio
+            if (type == Sniffer::AudioFile) { // try to get "coverart" from audio
                 QByteArray coverart = common.getEmbeddedCoverArt(filename);
                 if (coverart.size()==0) { continue; }
-                image.read(Magick::Blob(coverart.data(),
-                                        static_cast<size_t>(coverart.size())));
-            } else if (type.name().startsWith(QString("video"))) { // get frame from video
+                importer->import(filename,
+                                 Magick::Blob(coverart.data(),
+                                              static_cast<size_t>(coverart.size())),
+                                 view->getCanvasID());
+                continue;
+            } else if (type == Sniffer::VideoFile) { // get frame from video
                 image = getVideoFrameAsImage(filename);
-            } else { // "regular" image
-                if (Common::isValidCanvas(filename)) { continue; }
-                image.read(filename.toStdString());
-            }
-#else
-            if (type.name().startsWith(QString("audio")) ||
-                type.name().startsWith(QString("video"))) { continue; }
-            if (Common::isValidCanvas(filename)) {
-                // skip projects
+            } else { // "regular" image, decoded in the background
+                importer->import(filename,
+                                 Magick::Blob(),
+                                 view->getCanvasID());
                 continue;
             }
-            image.read(filename.toStdString());
+#else
+            if (type == Sniffer::AudioFile ||
+                type == Sniffer::VideoFile) { continue; }
+
+            // decoded in the background
+            importer->import(filename,
+                             Magick::Blob(),
+                             view->getCanvasID());
+            continue;
 #endif
 
             if (image.columns()<=0 ||
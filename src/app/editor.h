@@ -49,8 +49,17 @@
 #include <QTreeWidget>
 #include <QTreeWidgetItem>
 #include <QToolButton>
+#include <QTimer>
+#include <QThreadPool>
+#include <QLockFile>
+#include <QProgressBar>
 
 #include "common.h"
+#include "project.h"
+#include "importer.h"
+#include "bandwriter.h"
+#include "sniffer.h"
+#include "colorengine.h"
 #include "view.h"
 #include "layertree.h"
 #include "mdi.h"
@@ -84,7 +93,11 @@ private:
     QAction *newLayerAct;
     QAction *saveLayerAct;
     QAction *blackPointAct;
+    QAction *softProofAct;
+    QAction *gamutWarningAct;
     QAction *quitAct;
+    QAction *undoAct;
+    QAction *redoAct;
 
     QAction *viewMoveAct;
     QAction *viewDrawAct;
@@ -100,6 +113,7 @@ private:
     QAction *convertExtractAct;
 
     QMenu *fileMenu;
+    QMenu *editMenu;
     QMenu *optMenu;
     QMenu *helpMenu;
     QMenu *newMenu;
@@ -108,7 +122,11 @@ private:
     QMenu *colorProfileRGBMenu;
     QMenu *colorProfileCMYKMenu;
     QMenu *colorProfileGRAYMenu;
+    QMenu *colorProfileDisplayMenu;
     QMenu* colorIntentMenu;
+    QMenu *codecMenu;
+    QAction *benchmarkAct;
+    Magick::Blob brushColorProfile;
 
     QToolButton *newButton;
     QToolButton *saveButton;
@@ -122,6 +140,27 @@ private:
     QtColorTriangle *colorTriangle;
     QtColorPicker *colorPicker;
 
+    QFutureWatcher<Common::Canvas> *compactWatcher;
+
+    QTimer *autosaveTimer;
+    QThreadPool *autosavePool;
+    QThreadPool *autosaveEncoders;
+    QLockFile *autosaveLock;
+    QMap<QString, int> autosaveRevisions;
+    QMap<QString, QFuture<bool> > autosaveJobs;
+
+    QFutureWatcher<QList<Project::CodecResult> > *benchmarkWatcher;
+
+    QFutureWatcher<Common::Canvas> *convertWatcher;
+    QProgressBar *convertProgress;
+
+    Importer *importer;
+    QProgressBar *importProgress;
+    QToolButton *importCancel;
+    bool importTile;
+    QMap<int, QString> importStreams;
+    QMap<QString, QList<Magick::Image> > pendingLayers;
+
 signals:
 
     void openImage(const QString &filename);
@@ -186,11 +225,16 @@ private slots:
 
     // tabs
     void newTab(Common::Canvas canvas);
-    void newTab(Magick::Image image = Magick::Image(),
-                QSize geo = QSize(0, 0));
+    View* newTab(Magick::Image image = Magick::Image(),
+                 QSize geo = QSize(0, 0));
     void handleTabActivated(QMdiSubWindow *tab);
     void updateTabTitle(View *view = nullptr);
 
+    // history
+    void handleUndo();
+    void handleRedo();
+    void handleHistoryUpdated();
+
     // color
     void populateColorProfileMenu(QMenu *menu,
                                   Magick::ColorspaceType colorspace);
@@ -205,6 +249,9 @@ private slots:
     void populateColorIntentMenu();
     void setDefaultColorIntent();
     void loadDefaultColorIntent();
+    Common::RenderingIntent selectedColorIntent();
+    void handleBrushColorProfile(View *view = nullptr);
+    void handleDisplayProfile(View *view = nullptr);
     void handleColorConvertRGB(bool ignoreColor = false,
                                const QString &title = tr("Convert to RGB"));
     void handleColorConvertCMYK(bool ignoreColor = false,
@@ -215,6 +262,8 @@ private slots:
     void handleColorConvert(bool ignoreColor = false,
                             Magick::ColorspaceType colorspace = Magick::UndefinedColorspace,
                             const QString &title = tr("Convert"));
+    void handleColorConvertProgress(int percent);
+    void handleColorConvertFinished();
     void hasColorProfiles();
     void handleColorChanged(const QColor &color);
 
@@ -223,7 +272,7 @@ private slots:
     void saveSettings();
     void loadSettings();
 
-    void loadProject(const QString &filename);
+    bool loadProject(const QString &filename);
     void saveProject(const QString &filename);
 
     void saveImage(const QString &filename);
@@ -243,6 +292,31 @@ private slots:
 #endif
 
     void saveProjectDialog();
+    void handleSaveProject();
+    void handleProjectLoaded();
+    void handleProjectCompacted();
+    void handleAutosave();
+    void handleAutosaveRecovery();
+    void cleanupAutosave(bool all = false);
+    Project::Codec selectedProjectCodec();
+    void handleCodecBenchmark();
+    void handleCodecBenchmarkFinished();
+    void handleImportProfile(int id,
+                             int colorspace);
+    void handleImportProfileDialog(int result);
+    void handleImported(int id,
+                        Magick::Image image,
+                        const QString &target);
+    void handleImportProgress(int percent,
+                              int jobs);
+    void handleImportPreview(int id,
+                             const QRect &rect,
+                             const QImage &preview);
+    void handleImportBand(int id,
+                          const QRect &rect,
+                          Magick::Image pixels);
+    void handleImportStreamFinished(int id,
+                                    const QImage &overview);
     void saveImageDialog();
     void saveLayerDialog();
     void loadImageDialog();
@@ -229,6 +229,12 @@ void Editor::addLayerToView(Magick::Image image,
                             View *view)
 {
     if (!view || image.columns()==0 || image.rows()==0) { return; }
+
+    // added once the view is writable, converted to its profile by then
+    if (view->isReadOnly()) {
+        pendingLayers[view->getCanvasID()].append(image);
+        return;
+    }
     try {
         if (image.iccColorProfile().length()==0) {
             qDebug() << "layer is missing color profile, add default";
@@ -251,7 +257,7 @@ void Editor::addLayerToView(Magick::Image image,
         qDebug() << "convert layer to canvas color profile";
         image = Common::convertColorspace(image,
                                           image.iccColorProfile(),
-                                          view->getCanvasProject().profile);
+                                          view->getCanvasProject(false).profile);
         view->addLayer(image);
     }
     catch(Magick::Error &error_ ) { emit errorMessage(error_.what()); }
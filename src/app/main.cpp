@@ -31,16 +31,27 @@
 */
 
 #include "editor.h"
+#include "render.h"
 #include <QApplication>
+#include <QFile>
+#include <QScopedPointer>
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
-    QApplication::setApplicationName(QString("Cyan"));
-    QApplication::setOrganizationName(QString("FxArena"));
-    QApplication::setOrganizationDomain(QString("net.fxarena.cyan"));
-    QApplication::setApplicationVersion(QString(CYAN_VERSION));
+    // render farms have no display, don't pull in the gui
+    bool render = Render::isRender(argc, argv);
+    QScopedPointer<QCoreApplication> a(render?new QCoreApplication(argc, argv):
+                                              new QApplication(argc, argv));
+    QCoreApplication::setApplicationName(QString("Cyan"));
+    QCoreApplication::setOrganizationName(QString("FxArena"));
+    QCoreApplication::setOrganizationDomain(QString("net.fxarena.cyan"));
+    QCoreApplication::setApplicationVersion(QString(CYAN_VERSION));
 
+    // keep the disk-backed pixel cache in our own cache folder
+    if (qgetenv("MAGICK_TEMPORARY_PATH").isEmpty()) {
+        qputenv("MAGICK_TEMPORARY_PATH",
+                QFile::encodeName(Common::cachePath()));
+    }
     Magick::InitializeMagick(nullptr);
 #ifdef WITH_FFMPEG
     av_register_all();
@@ -52,8 +63,10 @@ int main(int argc, char *argv[])
 #endif
 #endif
 
+    if (render) { return Render::exec(a->arguments()); }
+
     Editor w;
     w.show();
 
-    return a.exec();
+    return a->exec();
 }
@@ -93,6 +93,7 @@ void Editor::setupUI()
     setMenuBar(mainMenu);
 
     mainMenu->addMenu(fileMenu);
+    mainMenu->addMenu(editMenu);
     mainMenu->addMenu(colorMenu);
     mainMenu->addMenu(optMenu);
     mainMenu->addMenu(helpMenu);
@@ -115,6 +116,9 @@ void Editor::setupUI()
     fileMenu->addSeparator();
     fileMenu->addAction(quitAct);
 
+    editMenu->addAction(undoAct);
+    editMenu->addAction(redoAct);
+
     helpMenu->addAction(aboutImageMagickAct);
     helpMenu->addAction(aboutLcmsAct);
     helpMenu->addAction(aboutQtAct);
@@ -138,6 +142,10 @@ void Editor::setupUI()
     colorMenu->addMenu(colorProfileCMYKMenu);
     colorMenu->addMenu(colorProfileGRAYMenu);
     colorMenu->addSeparator();
+    colorMenu->addMenu(colorProfileDisplayMenu);
+    colorMenu->addAction(softProofAct);
+    colorMenu->addAction(gamutWarningAct);
+    colorMenu->addSeparator();
     colorMenu->addMenu(colorIntentMenu);
     colorMenu->addAction(blackPointAct);
 
@@ -149,6 +157,8 @@ void Editor::setupUI()
                              Magick::CMYKColorspace);
     populateColorProfileMenu(colorProfileGRAYMenu,
                              Magick::GRAYColorspace);
+    populateColorProfileMenu(colorProfileDisplayMenu,
+                             Magick::sRGBColorspace);
     populateColorIntentMenu();
 
     QLabel *brushSizeLabel = new QLabel(this);
@@ -183,6 +193,9 @@ void Editor::setupMenus()
     fileMenu = new QMenu(this);
     fileMenu->setTitle(tr("File"));
 
+    editMenu = new QMenu(this);
+    editMenu->setTitle(tr("Edit"));
+
     optMenu = new QMenu(this);
     optMenu->setTitle(tr("Options"));
 
@@ -210,8 +223,15 @@ void Editor::setupMenus()
     colorProfileGRAYMenu->setTitle(tr("Default GRAY profile"));
     colorProfileGRAYMenu->setObjectName(QString("colorProfileGRAYMenu"));
 
+    colorProfileDisplayMenu = new QMenu(this);
+    colorProfileDisplayMenu->setTitle(tr("Display profile"));
+    colorProfileDisplayMenu->setObjectName(QString("colorProfileDisplayMenu"));
+
     colorIntentMenu = new QMenu(this);
     colorIntentMenu->setTitle(tr("Rendering Intent"));
+
+    codecMenu = new QMenu(this);
+    codecMenu->setTitle(tr("Project compression"));
 }
 
 void Editor::setupToolbars()
@@ -234,6 +254,27 @@ void Editor::setupWidgets()
     mainStatusBar = new QStatusBar(this);
     mainStatusBar->setObjectName(QString("mainStatusBar"));
 
+    importProgress = new QProgressBar(this);
+    importProgress->setRange(0, 100);
+    importProgress->setMaximumWidth(150);
+    importProgress->hide();
+    mainStatusBar->addPermanentWidget(importProgress);
+
+    importCancel = new QToolButton(this);
+    importCancel->setText(tr("Cancel"));
+    importCancel->setToolTip(tr("Cancel loading images"));
+    importCancel->setIcon(QIcon::fromTheme("process-stop"));
+    importCancel->setAutoRaise(true);
+    importCancel->hide();
+    mainStatusBar->addPermanentWidget(importCancel);
+
+    convertProgress = new QProgressBar(this);
+    convertProgress->setRange(0, 100);
+    convertProgress->setMaximumWidth(150);
+    convertProgress->setFormat(tr("Converting %p%"));
+    convertProgress->hide();
+    mainStatusBar->addPermanentWidget(convertProgress);
+
     brushSize = new QSlider(this);
     brushSize->setRange(1,256);
     brushSize->setValue(20);
@@ -258,7 +299,6 @@ void Editor::setupActions()
 
     saveProjectAsAct = new QAction(this);
     saveProjectAsAct->setText(tr("Save project as ..."));
-    saveProjectAsAct->setDisabled(true);
 
     newLayerAct = new QAction(this);
     newLayerAct->setText(tr("New layer"));
@@ -269,6 +309,14 @@ void Editor::setupActions()
     quitAct = new QAction(this);
     quitAct->setText(tr("Quit"));
 
+    undoAct = new QAction(this);
+    undoAct->setText(tr("Undo"));
+    undoAct->setDisabled(true);
+
+    redoAct = new QAction(this);
+    redoAct->setText(tr("Redo"));
+    redoAct->setDisabled(true);
+
     viewMoveAct = new QAction(this);
     viewMoveAct->setText(tr("Move"));
     viewMoveAct->setCheckable(true);
@@ -306,6 +354,17 @@ void Editor::setupActions()
     blackPointAct = new QAction(this);
     blackPointAct->setText(tr("Black point compensation"));
     blackPointAct->setCheckable(true);
+
+    softProofAct = new QAction(this);
+    softProofAct->setText(tr("Soft proof (default CMYK profile)"));
+    softProofAct->setCheckable(true);
+
+    gamutWarningAct = new QAction(this);
+    gamutWarningAct->setText(tr("Gamut warning (default CMYK profile)"));
+    gamutWarningAct->setCheckable(true);
+
+    benchmarkAct = new QAction(this);
+    benchmarkAct->setText(tr("Benchmark project compression"));
 }
 
 void Editor::setupButtons()
@@ -452,12 +511,16 @@ void Editor::setupConnections()
     connect(newImageAct, SIGNAL(triggered(bool)), this, SLOT(newImageDialog()));
     connect(newLayerAct, SIGNAL(triggered(bool)), this, SLOT(newLayerDialog()));
     connect(openImageAct, SIGNAL(triggered(bool)), this, SLOT(loadImageDialog()));
-    connect(saveProjectAct, SIGNAL(triggered(bool)), this, SLOT(saveProjectDialog()));
+    connect(saveProjectAct, SIGNAL(triggered(bool)), this, SLOT(handleSaveProject()));
+    connect(saveProjectAsAct, SIGNAL(triggered(bool)), this, SLOT(saveProjectDialog()));
     connect(saveImageAct, SIGNAL(triggered(bool)), this, SLOT(saveImageDialog()));
     connect(saveLayerAct, SIGNAL(triggered(bool)), this, SLOT(saveLayerDialog()));
 
     connect(quitAct, SIGNAL(triggered(bool)), this, SLOT(close()));
 
+    connect(undoAct, SIGNAL(triggered(bool)), this, SLOT(handleUndo()));
+    connect(redoAct, SIGNAL(triggered(bool)), this, SLOT(handleRedo()));
+
     connect(viewMoveAct, SIGNAL(triggered(bool)), this, SLOT(handleSetMoveMode(bool)));
     connect(viewDrawAct, SIGNAL(triggered(bool)), this, SLOT(handleSetDrawMode(bool)));
 
@@ -469,12 +532,27 @@ void Editor::setupConnections()
     connect(convertCMYKAct, SIGNAL(triggered()), this, SLOT(handleColorConvertCMYK()));
     connect(convertGRAYAct, SIGNAL(triggered()), this, SLOT(handleColorConvertGRAY()));
     connect(convertAssignAct, SIGNAL(triggered()), this, SLOT(handleColorProfileAssign()));
+    connect(blackPointAct, SIGNAL(toggled(bool)), this, SLOT(handleBrushColorProfile()));
+    connect(blackPointAct, SIGNAL(toggled(bool)), this, SLOT(handleDisplayProfile()));
+    connect(softProofAct, SIGNAL(toggled(bool)), this, SLOT(handleDisplayProfile()));
+    connect(gamutWarningAct, SIGNAL(toggled(bool)), this, SLOT(handleDisplayProfile()));
+    connect(benchmarkAct, SIGNAL(triggered()), this, SLOT(handleCodecBenchmark()));
 
     connect(this, SIGNAL(statusMessage(QString)), this, SLOT(handleStatus(QString)));
     connect(this, SIGNAL(warningMessage(QString)), this, SLOT(handleWarning(QString)));
     connect(this, SIGNAL(errorMessage(QString)), this, SLOT(handleError(QString)));
     connect(mdi, SIGNAL(openImages(QList<QUrl>)), this, SLOT(handleOpenImages(QList<QUrl>)));
 
+    connect(importer, SIGNAL(needsProfile(int,int)), this, SLOT(handleImportProfile(int,int)));
+    connect(importer, SIGNAL(imported(int,Magick::Image,QString)), this, SLOT(handleImported(int,Magick::Image,QString)));
+    connect(importer, SIGNAL(progressChanged(int,int)), this, SLOT(handleImportProgress(int,int)));
+    connect(importer, SIGNAL(previewReady(int,QRect,QImage)), this, SLOT(handleImportPreview(int,QRect,QImage)));
+    connect(importer, SIGNAL(bandReady(int,QRect,Magick::Image)), this, SLOT(handleImportBand(int,QRect,Magick::Image)));
+    connect(importer, SIGNAL(streamFinished(int,QImage)), this, SLOT(handleImportStreamFinished(int,QImage)));
+    connect(importer, SIGNAL(errorMessage(QString)), this, SLOT(handleError(QString)));
+    connect(importer, SIGNAL(warningMessage(QString)), this, SLOT(handleWarning(QString)));
+    connect(importCancel, SIGNAL(released()), importer, SLOT(cancelAll()));
+
     connect(layersTree, SIGNAL(selectedLayer(int)), this, SLOT(handleLayerTreeSelectedLayer(int)));
     connect(layersTree, SIGNAL(layerVisibilityChanged(int,bool)), this, SLOT(handleLayerVisibility(int,bool)));
     connect(layersTree, SIGNAL(layerLabelChanged(int,QString)), this, SLOT(handleLayerLabel(int,QString)));
@@ -495,6 +573,8 @@ void Editor::setupIcons()
     saveLayerAct->setIcon(QIcon::fromTheme("document-save"));
     saveProjectAsAct->setIcon(QIcon::fromTheme("document-save-as"));
     quitAct->setIcon(QIcon::fromTheme("application-exit"));
+    undoAct->setIcon(QIcon::fromTheme("edit-undo"));
+    redoAct->setIcon(QIcon::fromTheme("edit-redo"));
 
     viewMoveAct->setIcon(QIcon::fromTheme("transform_move"));
     viewDrawAct->setIcon(QIcon::fromTheme("paintbrush"));
@@ -510,8 +590,11 @@ void Editor::setupIcons()
     colorProfileRGBMenu->setIcon(colorWheelIcon);
     colorProfileCMYKMenu->setIcon(colorWheelIcon);
     colorProfileGRAYMenu->setIcon(colorWheelIcon);
+    colorProfileDisplayMenu->setIcon(QIcon::fromTheme("monitor_window_flow"));
     colorIntentMenu->setIcon(QIcon::fromTheme("monitor_window_flow"));
     blackPointAct->setIcon(colorWheelIcon);
+    softProofAct->setIcon(QIcon::fromTheme("monitor_window_flow"));
+    gamutWarningAct->setIcon(QIcon::fromTheme("monitor_window_flow"));
 
     aboutQtAct->setIcon(QIcon::fromTheme("help-about"));
     aboutLcmsAct->setIcon(QIcon::fromTheme("help-about"));
@@ -523,10 +606,29 @@ void Editor::setupShortcuts()
     newImageAct->setShortcut(QKeySequence(tr("Ctrl+N")));
     newLayerAct->setShortcut(QKeySequence(tr("Ctrl+L")));
     openImageAct->setShortcut(QKeySequence(tr("Ctrl+O")));
+    saveProjectAct->setShortcut(QKeySequence(tr("Ctrl+S")));
+    saveProjectAsAct->setShortcut(QKeySequence(tr("Ctrl+Shift+S")));
     quitAct->setShortcut(QKeySequence(tr("Ctrl+Q")));
+    undoAct->setShortcut(QKeySequence(tr("Ctrl+Z")));
+    redoAct->setShortcut(QKeySequence(tr("Ctrl+Shift+Z")));
 }
 
 void Editor::setupOptions()
 {
-
+    // working saves favour speed, archives favour size
+    QActionGroup *codecGroup = new QActionGroup(this);
+    QList<Project::Codec> codecs;
+    codecs << Project::FastCodec << Project::BalancedCodec << Project::ArchiveCodec;
+    for (int i=0;i<codecs.size();++i) {
+        QAction *action = new QAction(codecMenu);
+        action->setText(Project::codecName(codecs.at(i)));
+        action->setData(codecs.at(i));
+        action->setCheckable(true);
+        action->setChecked(codecs.at(i) == Project::FastCodec);
+        codecGroup->addAction(action);
+        codecMenu->addAction(action);
+    }
+
+    optMenu->addMenu(codecMenu);
+    optMenu->addAction(benchmarkAct);
 }
@@ -56,6 +56,8 @@ void Editor::newTab(Common::Canvas canvas)
     view->setLayersFromCanvas(canvas);
     view->setFit(true);
     view->setBrushColor(colorPicker->currentColor());
+    handleBrushColorProfile(view);
+    handleDisplayProfile(view);
 
     tab->setWidget(view);
     tab->showMaximized();
@@ -68,12 +70,13 @@ void Editor::newTab(Common::Canvas canvas)
     } else if (viewDrawAct->isChecked()) {
         view->setInteractiveMode(View::InteractiveDrawMode);
     }*/
+    view->clearHistory();
     setViewTool(view);
     updateTabTitle(view);
     handleTabActivated(tab);
 }
 
-void Editor::newTab(Magick::Image image, QSize geo)
+View* Editor::newTab(Magick::Image image, QSize geo)
 {
     qDebug() << "new tab from image";
     //if (!image.isValid()) { return; }
@@ -108,6 +111,8 @@ void Editor::newTab(Magick::Image image, QSize geo)
     else { view->addLayer(image); }
     view->setFit(true);
     view->setBrushColor(colorPicker->currentColor());
+    handleBrushColorProfile(view);
+    handleDisplayProfile(view);
 
     tab->setWidget(view);
     tab->showMaximized();
@@ -120,10 +125,11 @@ void Editor::newTab(Magick::Image image, QSize geo)
     } else if (viewDrawAct->isChecked()) {
         view->setInteractiveMode(View::InteractiveDrawMode);
     }*/
+    view->clearHistory();
     setViewTool(view);
     updateTabTitle(view);
     handleTabActivated(tab);
-    //return view;
+    return view;
 }
 
 void Editor::handleTabActivated(QMdiSubWindow *tab)
@@ -142,6 +148,11 @@ void Editor::handleTabActivated(QMdiSubWindow *tab)
     }*/
     updateTabTitle();
     handleBrushSize();
+    handleHistoryUpdated();
+
+    // no layer edits while a background conversion owns the canvas
+    newLayerAct->setEnabled(!view->isReadOnly());
+    layersTree->setEnabled(!view->isReadOnly());
 }
 
 void Editor::updateTabTitle(View *view)
@@ -152,3 +163,32 @@ void Editor::updateTabTitle(View *view)
     qDebug() << "update canvas title" << title;
     view->setWindowTitle(title);
 }
+
+void Editor::handleUndo()
+{
+    View *view = getCurrentView();
+    if (!view) { return; }
+    QString label = view->undoLabel();
+    if (!view->undo()) { return; }
+    updateTabTitle(view);
+    emit statusMessage(tr("Undo %1").arg(label));
+}
+
+void Editor::handleRedo()
+{
+    View *view = getCurrentView();
+    if (!view) { return; }
+    QString label = view->redoLabel();
+    if (!view->redo()) { return; }
+    updateTabTitle(view);
+    emit statusMessage(tr("Redo %1").arg(label));
+}
+
+void Editor::handleHistoryUpdated()
+{
+    View *view = getCurrentView();
+    undoAct->setEnabled(view && !view->isReadOnly() && view->canUndo());
+    redoAct->setEnabled(view && !view->isReadOnly() && view->canRedo());
+    undoAct->setText(view && view->canUndo()?tr("Undo %1").arg(view->undoLabel()):tr("Undo"));
+    redoAct->setText(view && view->canRedo()?tr("Redo %1").arg(view->redoLabel()):tr("Redo"));
+}
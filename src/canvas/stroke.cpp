@@ -0,0 +1,196 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "stroke.h"
+
+#include <QLineF>
+#include <QtMath>
+
+// max length (in pixels) of each linear piece used to approximate a curve
+#define STROKE_CURVE_STEP 2.0
+
+Stroke::Stroke()
+    : _active(false)
+    , _spacing(1.0)
+    , _distance(0.0)
+    , _interpolation(Stroke::CatmullRomInterpolation)
+{
+}
+
+void Stroke::begin(const QPointF &pos)
+{
+    _samples.clear();
+    _dabs.clear();
+    _samples.append(pos);
+    _dabs.append(pos);
+    _distance = 0.0;
+    _active = true;
+}
+
+void Stroke::addSample(const QPointF &pos)
+{
+    if (!_active || _samples.last() == pos) { return; }
+    _samples.append(pos);
+
+    if (_interpolation == Stroke::LinearInterpolation) {
+        walkSegment(_samples.at(0), _samples.at(1));
+        _samples.removeFirst();
+        return;
+    }
+
+    // catmull-rom needs the next sample before a segment can be drawn,
+    // the first segment reuses the first sample as its control point
+    if (_samples.size() == 3) {
+        walkCurve(_samples.at(0),
+                  _samples.at(0),
+                  _samples.at(1),
+                  _samples.at(2));
+    } else if (_samples.size() == 4) {
+        walkCurve(_samples.at(0),
+                  _samples.at(1),
+                  _samples.at(2),
+                  _samples.at(3));
+        _samples.removeFirst();
+    }
+}
+
+void Stroke::end()
+{
+    if (!_active) { return; }
+
+    // draw the pending segment (catmull-rom only)
+    if (_interpolation == Stroke::CatmullRomInterpolation) {
+        if (_samples.size() == 2) {
+            walkCurve(_samples.at(0),
+                      _samples.at(0),
+                      _samples.at(1),
+                      _samples.at(1));
+        } else if (_samples.size() == 3) {
+            walkCurve(_samples.at(0),
+                      _samples.at(1),
+                      _samples.at(2),
+                      _samples.at(2));
+        }
+    }
+    _samples.clear();
+    _active = false;
+}
+
+bool Stroke::isActive()
+{
+    return _active;
+}
+
+QVector<QPointF> Stroke::takeDabs()
+{
+    QVector<QPointF> result = _dabs;
+    _dabs.clear();
+    return result;
+}
+
+bool Stroke::hasDabs()
+{
+    return _dabs.size()>0;
+}
+
+double Stroke::getSpacing()
+{
+    return _spacing;
+}
+
+void Stroke::setSpacing(double spacing)
+{
+    if (spacing<1.0) { spacing = 1.0; }
+    _spacing = spacing;
+}
+
+Stroke::Interpolation Stroke::getInterpolation()
+{
+    return _interpolation;
+}
+
+void Stroke::setInterpolation(Stroke::Interpolation mode)
+{
+    _interpolation = mode;
+}
+
+QRectF Stroke::dabsRect(const QVector<QPointF> &dabs,
+                        double radius)
+{
+    QRectF result;
+    for (int i=0;i<dabs.size();++i) {
+        QRectF dab(dabs.at(i).x()-radius,
+                   dabs.at(i).y()-radius,
+                   radius*2,
+                   radius*2);
+        result = result.isNull()?dab:result.united(dab);
+    }
+    return result;
+}
+
+void Stroke::walkSegment(const QPointF &from,
+                         const QPointF &to)
+{
+    // place dabs at a fixed spacing, carry the remainder to the next segment
+    double length = QLineF(from, to).length();
+    if (length<=0.0) { return; }
+    double pos = _spacing-_distance;
+    while (pos<=length) {
+        double t = pos/length;
+        _dabs.append(QPointF(from.x()+(to.x()-from.x())*t,
+                             from.y()+(to.y()-from.y())*t));
+        pos += _spacing;
+    }
+    _distance = length-(pos-_spacing);
+}
+
+void Stroke::walkCurve(const QPointF &p0,
+                       const QPointF &p1,
+                       const QPointF &p2,
+                       const QPointF &p3)
+{
+    // approximate the p1->p2 catmull-rom segment with short lines
+    double chord = QLineF(p1, p2).length();
+    int steps = qBound(1, qCeil(chord/STROKE_CURVE_STEP), 512);
+    QPointF last = p1;
+    for (int i=1;i<=steps;++i) {
+        double t = static_cast<double>(i)/steps;
+        double t2 = t*t;
+        double t3 = t2*t;
+        QPointF point = 0.5*((2*p1)+
+                             (-p0+p2)*t+
+                             (2*p0-5*p1+4*p2-p3)*t2+
+                             (-p0+3*p1-3*p2+p3)*t3);
+        walkSegment(last, point);
+        last = point;
+    }
+}
@@ -34,6 +34,7 @@
 
 #include <QPointF>
 #include <QPen>
+#include <QPainter>
 
 TileItem::TileItem(QGraphicsItem *parent, QGraphicsPixmapItem *pixmapItem)
     : QGraphicsRectItem(parent)
@@ -67,3 +68,24 @@ void TileItem::setPixmap(int id, const QPixmap &pixmap)
     if (!_pixmap || this->data(0).toInt()!=id) { return; }
     setPixmap(pixmap);
 }
+
+void TileItem::setPixmapRegion(int id,
+                               const QPoint &offset,
+                               const QImage &image)
+{
+    if (!_pixmap || this->data(0).toInt()!=id || image.isNull()) { return; }
+
+    QPixmap pixmap = _pixmap->pixmap();
+    if (pixmap.isNull()) {
+        pixmap = QPixmap(rect().size().toSize());
+        pixmap.fill(Qt::transparent);
+    }
+
+    // replace the region, keep the rest of the tile
+    QPainter painter(&pixmap);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(offset, image);
+    painter.end();
+
+    _pixmap->setPixmap(pixmap);
+}
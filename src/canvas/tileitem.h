@@ -37,6 +37,7 @@
 #include <QGraphicsRectItem>
 #include <QGraphicsPixmapItem>
 #include <QPixmap>
+#include <QImage>
 
 #include "layeritem.h"
 
@@ -61,6 +62,9 @@ public slots:
     QGraphicsPixmapItem* getPixmapItem();
     void setPixmap(const QPixmap &pixmap);
     void setPixmap(int id, const QPixmap &pixmap);
+    void setPixmapRegion(int id,
+                         const QPoint &offset,
+                         const QImage &image);
 };
 
 #endif // TILEITEM_H
@@ -39,10 +39,15 @@
 #include <QPixmap>
 #include <QImage>
 #include <QTransform>
+#include <QPainter>
 #include <QtConcurrent/QtConcurrent>
 #include <QTimer>
 
 #include "common.h"
+#include "transformcache.h"
+#include "project.h"
+#include "sniffer.h"
+#include "profileregistry.h"
 
 View::View(QWidget* parent, bool setup) :
     QGraphicsView(parent)
@@ -54,6 +59,21 @@ View::View(QWidget* parent, bool setup) :
   , _moving(false)
   , _selectedLayer(0)
   , _supportsLayers(true)
+  , _strokeTimer(nullptr)
+  , _strokeLayer(-1)
+  , _brushWatcher(nullptr)
+  , _history(nullptr)
+  , _brushIntent(Common::PerceptualRenderingIntent)
+  , _brushBlackPoint(true)
+  , _chunkWatcher(nullptr)
+  , _chunkLayer(-1)
+  , _projectFile(nullptr)
+  , _projectMap(nullptr)
+  , _projectMapSize(0)
+  , _projectReleased(false)
+  , _displayIntent(Common::PerceptualRenderingIntent)
+  , _displayBlackPoint(true)
+  , _readOnly(false)
 {
     // setup the basics
     setAcceptDrops(true);
@@ -84,6 +104,26 @@ View::View(QWidget* parent, bool setup) :
     _brush->hide();
     _scene->addItem(_brush);
 
+    // setup brush stroke, dabs are applied once per frame
+    _stroke.setSpacing(_brush->rect().width()/4);
+    _strokeTimer = new QTimer(this);
+    _strokeTimer->setInterval(STROKE_FRAME_MS);
+    connect(_strokeTimer, SIGNAL(timeout()),
+            this, SLOT(handleBrushStroke()));
+
+    // brush updates are composited on a worker, one batch at a time
+    _brushWatcher = new QFutureWatcher<void>(this);
+    connect(_brushWatcher, SIGNAL(finished()),
+            this, SLOT(handleBrushRendered()));
+
+    // project tiles are decoded in the background, one at a time
+    _chunkWatcher = new QFutureWatcher<Magick::Image>(this);
+    connect(_chunkWatcher, SIGNAL(finished()),
+            this, SLOT(handleChunkLoaded()));
+
+    // setup undo/redo
+    _history = new History(this);
+
     // connect zoom
     connect(this, SIGNAL(resetZoom()),
             this, SLOT(resetImageZoom()));
@@ -94,7 +134,11 @@ View::View(QWidget* parent, bool setup) :
 
 View::~View()
 {
-    // cleanup
+    // cleanup, workers still reference this view
+    _strokeTimer->stop();
+    _brushWatcher->waitForFinished();
+    _chunkWatcher->waitForFinished();
+    closeProjectFile();
     clearTiles();
     clearLayers();
     clearScene();
@@ -142,7 +186,7 @@ void View::mousePressEvent(QMouseEvent *event)
                          Qt::LeftButton,
                          event->modifiers());
         QGraphicsView::mousePressEvent(&fake);
-    } else if (_drawing) {
+    } else if (_drawing && !_readOnly) {
         // get draw POS
         QPointF pos = mapToScene(event->pos());
         QPointF newPOS;
@@ -153,8 +197,8 @@ void View::mousePressEvent(QMouseEvent *event)
                         _brush->rect().width(),
                         _brush->rect().height());
         if (event->buttons() & Qt::LeftButton) {
-            // draw over tile at POS
-            handleBrushOverTile(pos);
+            // start new stroke at POS
+            beginBrushStroke(pos);
         }
     }
     //else if ((event->buttons() & Qt::LeftButton) && (event->buttons() & Qt::RightButton)) { emit resetZoom(); }
@@ -186,7 +230,10 @@ void View::mouseReleaseEvent(QMouseEvent *event)
         QGraphicsView::mouseReleaseEvent(&fake);
         emit isDrag(false);
         return;
-    } /*else if (event->button() == Qt::LeftButton) {
+    } else if (event->button() == Qt::LeftButton && _stroke.isActive()) {
+        endBrushStroke();
+    }
+    /*else if (event->button() == Qt::LeftButton) {
         if (_drawing) {
             QPointF pos = mapToScene(event->pos());
             QPointF newPOS;
@@ -227,9 +274,10 @@ void View::mouseMoveEvent(QMouseEvent *event)
                         newPOS.y(),
                         _brush->rect().width(),
                         _brush->rect().height());
-        if (event->buttons() & Qt::LeftButton) {
-            // draw over tile at POS
-            handleBrushOverTile(pos);
+        if ((event->buttons() & Qt::LeftButton) && !_readOnly) {
+            // add POS to stroke
+            if (!_stroke.isActive()) { beginBrushStroke(pos); }
+            else { _stroke.addSample(pos); }
         }
     }
     /*else if (event->buttons() & Qt::RightButton) {
@@ -241,6 +289,12 @@ void View::mouseMoveEvent(QMouseEvent *event)
 
 void View::dragEnterEvent(QDragEnterEvent *event)
 {
+    // classified once per file, drag-overs are served from the cache
+    if (!event->mimeData()->hasUrls() ||
+        !Sniffer::hasMedia(event->mimeData()->urls())) {
+        event->ignore();
+        return;
+    }
     event->acceptProposedAction();
 }
 
@@ -258,7 +312,7 @@ void View::dropEvent(QDropEvent *event)
 {
     const QMimeData *mimeData = event->mimeData();
     qDebug() << mimeData->formats();
-    if (mimeData->hasUrls()) {
+    if (mimeData->hasUrls() && !_readOnly) {
         if (!_supportsLayers) { emit openImages(mimeData->urls()); }
         else { emit openLayers(mimeData->urls()); }
     }
@@ -328,12 +382,14 @@ void View::setLayer(Magick::Image image,
                     int id)
 {
     _canvas.layers[id].image = image;
+    Project::markDirty(&_canvas.layers[id]);
     refreshTiles();
 }
 
 void View::addLayer(Magick::Image image,
                     bool updateView)
 {
+    if (_readOnly) { return; }
     qDebug() << "ADD LAYER" << QString::fromStdString(image.label());
     int id = _canvas.layers.size();
     _canvas.layers[id].image = image;
@@ -371,8 +427,11 @@ void View::addLayer(Magick::Image image,
     layer->setMovable(true);
     layer->setZValue(LAYER_Z);
 
+    _history->recordAddLayer(id, _canvas.layers[id]);
+
     emit addedLayer(id);
     emit updatedLayers();
+    emit updatedHistory();
 
     if (updateView) { /*handleLayerOverTiles(layer);*/ refreshTiles(); }
 }
@@ -438,16 +497,75 @@ QSize View::getCanvasSize()
                  static_cast<int>(_canvas.image.rows()));
 }
 
-Common::Canvas View::getCanvasProject()
+Common::Canvas View::getCanvasProject(bool complete)
 {
+    if (complete) { loadAllChunks(); }
     return _canvas;
 }
 
+void View::releaseProjectFile()
+{
+    // the project file is about to be replaced, which fails on some
+    // platforms while it's open or mapped, lazy loading pauses until
+    // setProjectFile() or restoreProjectFile()
+    _projectReleased = true;
+    _chunkWatcher->waitForFinished();
+    closeProjectFile();
+}
+
+void View::restoreProjectFile()
+{
+    // the project file was left as it was
+    _projectReleased = false;
+    openProjectFile(_canvas.filename);
+    loadNextChunk();
+}
+
+void View::setProjectFile(const Common::Canvas &canvas,
+                          bool merge)
+{
+    // chunks have moved to the saved project file
+    _chunkWatcher->waitForFinished();
+    _projectReleased = false;
+    _canvas.filename = canvas.filename;
+    openProjectFile(_canvas.filename);
+    QMapIterator<int, Common::Layer> layers(canvas.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        if (!_canvas.layers.contains(layers.key())) { continue; }
+        Common::Layer &layer = _canvas.layers[layers.key()];
+        const QList<Common::Chunk> &moved = layers.value().saved;
+        if (!merge) {
+            layer.chunks = layers.value().chunks;
+            layer.saved = moved;
+            continue;
+        }
+
+        // tiles changed since a background save was started stay changed
+        QList<Common::Chunk> *lists[2] = { &layer.chunks, &layer.saved };
+        for (int list=0;list<2;++list) {
+            for (int i=lists[list]->size()-1;i>=0;--i) {
+                bool found = false;
+                for (int y=0;y<moved.size();++y) {
+                    if (moved.at(y).rect != lists[list]->at(i).rect) { continue; }
+                    (*lists[list])[i] = moved.at(y);
+                    found = true;
+                    break;
+                }
+                if (!found) { lists[list]->removeAt(i); }
+            }
+        }
+    }
+    loadNextChunk();
+}
+
 void View::setLayerVisibility(int layer,
                               bool layerIsVisible)
 {
+    if (_readOnly) { return; }
     if (_canvas.layers[layer].visible != layerIsVisible) {
         _canvas.layers[layer].visible = layerIsVisible;
+        _history->touch();
         handleLayerOverTiles(layer);
     }
 }
@@ -460,8 +578,10 @@ bool View::getLayerVisibility(int layer)
 void View::setLayerComposite(int layer,
                              Magick::CompositeOperator composite)
 {
+    if (_readOnly) { return; }
     if (_canvas.layers[layer].composite != composite) {
         _canvas.layers[layer].composite = composite;
+        _history->touch();
         handleLayerOverTiles(layer);
     }
 }
@@ -484,14 +604,78 @@ Common::Layer View::getLayer(int layer)
 void View::setLayer(int layer, Magick::Image image)
 {
     _canvas.layers[layer].image = image;
+    Project::markDirty(&_canvas.layers[layer]);
     emit updatedLayers();
 }
 
+void View::setLayerPixels(int layer,
+                          const QRect &rect,
+                          Magick::Image pixels)
+{
+    // pixels arriving from a streamed import, not an edit
+    if (_readOnly || !_canvas.layers.contains(layer) || !pixels.isValid()) { return; }
+    try {
+        _canvas.layers[layer].image.composite(pixels,
+                                              rect.x(),
+                                              rect.y(),
+                                              Magick::CopyCompositeOp);
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    handleBrushDirty(QRectF(rect)
+                     .translated(_canvas.layers[layer].pos.width(),
+                                 _canvas.layers[layer].pos.height()));
+}
+
+void View::setLayerPreview(int layer,
+                           const QRect &rect,
+                           const QImage &preview)
+{
+    // scaled up stand-in for pixels that are not rendered yet,
+    // the tiles are painted over once setLayerPixels() is done
+    if (!_canvas.layers.contains(layer) || rect.isEmpty() || preview.isNull()) { return; }
+    QRect area = rect.translated(_canvas.layers[layer].pos.width(),
+                                 _canvas.layers[layer].pos.height());
+    double scaleX = static_cast<double>(preview.width())/area.width();
+    double scaleY = static_cast<double>(preview.height())/area.height();
+
+    QMapIterator<int, Common::Tile> i(_canvas.tiles);
+    while (i.hasNext()) {
+        i.next();
+        QRect tileRect = i.value().rect->rect().toAlignedRect();
+        QRect region = tileRect.intersected(area);
+        if (region.isEmpty()) { continue; }
+        QRectF source((region.x()-area.x())*scaleX,
+                      (region.y()-area.y())*scaleY,
+                      region.width()*scaleX,
+                      region.height()*scaleY);
+        QImage image(region.size(), QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(QRectF(QPointF(0, 0), QSizeF(region.size())),
+                          preview,
+                          source);
+        painter.end();
+        emit updateTileRegion(i.key(),
+                              region.topLeft()-tileRect.topLeft(),
+                              image);
+    }
+}
+
+void View::setLayerThumbnail(int layer,
+                             const QImage &thumbnail)
+{
+    if (!_canvas.layers.contains(layer)) { return; }
+    _canvas.layers[layer].thumbnail = thumbnail;
+}
+
 void View::setLayerFromCanvas(Common::Canvas canvas,
                               int layer)
 {
     _canvas.layers[layer].image = canvas.image;
     _canvas.layers[layer].layers = canvas.layers;
+    Project::markDirty(&_canvas.layers[layer]);
     emit updatedLayers();
 }
 
@@ -502,6 +686,8 @@ void View::setLayersFromCanvas(Common::Canvas canvas)
         return;
     }
     _canvas.layers = canvas.layers;
+    _canvas.filename = canvas.filename;
+    openProjectFile(_canvas.filename);
     QMapIterator<int, Common::Layer> layers(_canvas.layers);
     while (layers.hasNext()) {
         layers.next();
@@ -516,12 +702,29 @@ void View::setLayersFromCanvas(Common::Canvas canvas)
     }
     emit updatedLayers();
     refreshTiles();
+    loadNextChunk();
 }
 
-void View::updateCanvas(Common::Canvas canvas)
+void View::updateCanvas(Common::Canvas canvas,
+                        const QString &action)
 {
+    if (!action.isEmpty()) {
+        // the step being replaced is recorded with all of its pixels
+        loadAllChunks();
+        _history->recordCanvas(action, _canvas, canvas);
+        emit updatedHistory();
+
+        // pixels have changed, nothing can be reused on save
+        QMutableMapIterator<int, Common::Layer> layers(canvas.layers);
+        while (layers.hasNext()) {
+            layers.next();
+            Project::markDirty(&layers.value());
+        }
+    }
     _image = canvas.image;
     _canvas = canvas;
+    updateBrushNativeColor();
+    updateDisplayLut();
     refreshTiles();
 }
 
@@ -533,7 +736,9 @@ QSize View::getLayerOffset(int layer)
 void View::setLayerOffset(int layer,
                           QSize offset)
 {
+    if (_readOnly || _canvas.layers[layer].pos == offset) { return; }
     _canvas.layers[layer].pos = offset;
+    _history->touch();
 }
 
 QString View::getLayerName(int layer)
@@ -544,7 +749,9 @@ QString View::getLayerName(int layer)
 void View::setLayerName(int layer,
                         QString name)
 {
+    if (_readOnly || _canvas.layers[layer].label == name) { return; }
     _canvas.layers[layer].label = name;
+    _history->touch();
 }
 
 double View::getLayerOpacity(int layer)
@@ -556,12 +763,15 @@ void View::setLayerOpacity(int layer,
                            double value,
                            bool update)
 {
+    if (_readOnly) { return; }
+    if (!qFuzzyCompare(_canvas.layers[layer].opacity, value)) { _history->touch(); }
     _canvas.layers[layer].opacity = value;
     if (update) { handleLayerOverTiles(layer); }
 }
 
 void View::removeLayer(int layer)
 {
+    if (_readOnly) { return; }
     if (layer<0) { return; }
     QList<QGraphicsItem*> items = _scene->items();
     for (int i=0;i<items.size();++i) {
@@ -574,6 +784,10 @@ void View::removeLayer(int layer)
             break;
         }
     }
+    if (_canvas.layers.contains(layer)) {
+        _history->recordRemoveLayer(layer, _canvas.layers[layer]);
+        emit updatedHistory();
+    }
     _canvas.layers.remove(layer);
     emit updatedLayers();
     emit statusMessage(tr("Removed layer %1 from canvas")
@@ -615,6 +829,9 @@ void View::setupCanvas(int width,
     // set timestamp
     _canvas.timestamp = Common::timestamp();
 
+    // setup display transform
+    updateDisplayLut();
+
     // setup canvas tiles
     initTiles();
 
@@ -680,6 +897,57 @@ void View::moveLayerEvent(QKeyEvent *e)
     View::keyPressEvent(e);
 }
 
+int View::getRevision()
+{
+    return _history->getRevision();
+}
+
+bool View::canUndo()
+{
+    return _history->canUndo();
+}
+
+bool View::canRedo()
+{
+    return _history->canRedo();
+}
+
+const QString View::undoLabel()
+{
+    return _history->undoLabel();
+}
+
+const QString View::redoLabel()
+{
+    return _history->redoLabel();
+}
+
+bool View::undo()
+{
+    if (_stroke.isActive() || _readOnly) { return false; }
+    _brushWatcher->waitForFinished();
+    if (!_history->undo(&_canvas)) { return false; }
+    syncLayerItems();
+    emit updatedHistory();
+    return true;
+}
+
+bool View::redo()
+{
+    if (_stroke.isActive() || _readOnly) { return false; }
+    _brushWatcher->waitForFinished();
+    if (!_history->redo(&_canvas)) { return false; }
+    syncLayerItems();
+    emit updatedHistory();
+    return true;
+}
+
+void View::clearHistory()
+{
+    _history->clear();
+    emit updatedHistory();
+}
+
 // TODO
 void View::setCanvasSpecsFromImage(Magick::Image image)
 {
@@ -697,12 +965,15 @@ void View::setCanvasSpecsFromImage(Magick::Image image)
     _scene->setSceneRect(0, 0, image.columns(), image.rows());
     _rect->setRect(0, 0, image.columns(), image.rows());
     _canvas.image = _image;
+    _canvas.timestamp = Common::timestamp();
 
     // save color profile
-    _canvas.profile = image.iccColorProfile();
+    _canvas.profile = ProfileRegistry::intern(image.iccColorProfile());
     if (_canvas.profile.length()==0) {
         emit errorMessage(tr("Missing color profile!"));
     }
+    updateBrushNativeColor();
+    updateDisplayLut();
 
     // setup canvas tiles
     initTiles();
@@ -764,12 +1035,43 @@ void View::setBrushStroke(int stroke)
                     pos.y()-(_brush->rect().height()/2),
                     stroke,
                     stroke);
+    _stroke.setSpacing(stroke/4.0);
     emit updatedBrushStroke(stroke);
 }
 
 void View::setBrushColor(const QColor &color)
 {
     _canvas.brushColor = color;
+    updateBrushNativeColor();
+}
+
+void View::setBrushColorProfile(const Magick::Blob &profile,
+                                Common::RenderingIntent intent,
+                                bool blackpoint)
+{
+    _brushProfile = profile;
+    _brushIntent = intent;
+    _brushBlackPoint = blackpoint;
+    updateBrushNativeColor();
+}
+
+void View::setStrokeInterpolation(Stroke::Interpolation mode)
+{
+    _stroke.setInterpolation(mode);
+}
+
+void View::setDisplayProfile(const Magick::Blob &monitor,
+                             const Magick::Blob &proof,
+                             const Magick::Blob &gamut,
+                             Common::RenderingIntent intent,
+                             bool blackpoint)
+{
+    _displayProfile = monitor;
+    _proofProfile = proof;
+    _gamutProfile = gamut;
+    _displayIntent = intent;
+    _displayBlackPoint = blackpoint;
+    if (updateDisplayLut()) { refreshTiles(); }
 }
 
 void View::handleLayerMoving(QPointF pos, int id, bool forceRender)
@@ -858,6 +1160,10 @@ QMap<int, Common::Tile> View::setupTiles(Magick::Image image,
                 SIGNAL(updateTilePixmap(int, QPixmap)),
                 result[i].rect,
                 SLOT(setPixmap(int, QPixmap)));
+        connect(this,
+                SIGNAL(updateTileRegion(int, QPoint, QImage)),
+                result[i].rect,
+                SLOT(setPixmapRegion(int, QPoint, QImage)));
 
         // set tile id
         result[i].rect->setData(0, i);
@@ -993,63 +1299,403 @@ void View::handleTileStatus()
     }
 }
 
-void View::handleBrushOverTile(QPointF pos,
-                               bool draw)
+void View::beginBrushStroke(QPointF pos)
 {
+    if (_readOnly) { return; }
+
+    // paint on the top-most layer under the brush
+    _strokeLayer = -1;
     QList<QGraphicsItem*> items = _scene->collidingItems(_brush);
-    bool foundLayer = false;
     for (int i=0;i<items.size();++i) {
-
         LayerItem *layerItem = dynamic_cast<LayerItem*>(items.at(i));
-        if (layerItem && draw && !foundLayer) { // draw
-            foundLayer = true;
-            QPointF epos;
-            int id = layerItem->getID();
-            epos.setX(pos.x()-_canvas.layers[id].pos.width());
-            epos.setY(pos.y()-_canvas.layers[id].pos.height());
-
-            _canvas.layers[id].image.strokeAntiAlias(_canvas.brushAA);
-            _canvas.layers[id].image.strokeLineCap(_canvas.brushLineCap);
-            _canvas.layers[id].image.strokeLineJoin(_canvas.brushLineJoin);
-            _canvas.layers[id].image.strokeWidth(_brush->rect().width());
-
-            if (_canvas.layers[id].image.colorSpace() == Magick::CMYKColorspace) {
-                // TODO! : need im workaround for this to work
-                _canvas.layers[id].image.strokeColor(Magick::ColorRGB(_canvas.brushColor.cyanF(),
-                                                                      _canvas.brushColor.magentaF(),
-                                                                      _canvas.brushColor.yellowF()));
-            } else {
-                _canvas.layers[id].image.strokeColor(Magick::ColorRGB(_canvas.brushColor.redF(),
-                                                                      _canvas.brushColor.greenF(),
-                                                                      _canvas.brushColor.blueF()));
-            }
-            _canvas.layers[id].image.draw(Magick::DrawableLine(epos.x()-1,
-                                                               epos.y()-1,
-                                                               epos.x(),
-                                                               epos.y()));
+        if (!layerItem) { continue; }
+        _strokeLayer = layerItem->getID();
+        break;
+    }
+
+    _history->beginTiles(tr("Brush stroke"));
+
+    _strokeLastDab = pos;
+    _stroke.begin(pos);
+    _strokeTimer->start();
+}
+
+void View::endBrushStroke()
+{
+    _stroke.end();
+    _strokeTimer->stop();
+    handleBrushStroke();
+    _strokeLayer = -1;
+    _history->commitTiles(_canvas);
+    emit updatedHistory();
+}
+
+void View::handleBrushStroke()
+{
+    if (!_stroke.hasDabs()) { return; }
+    QVector<QPointF> dabs = _stroke.takeDabs();
+    int id = _strokeLayer;
+    if (id<0 || !_canvas.layers.contains(id)) { return; }
+
+    // connect the last applied dab with the new dabs
+    dabs.prepend(_strokeLastDab);
+    _strokeLastDab = dabs.last();
+
+    Magick::CoordinateList path;
+    for (int i=0;i<dabs.size();++i) {
+        path.push_back(Magick::Coordinate(dabs.at(i).x()-_canvas.layers[id].pos.width(),
+                                          dabs.at(i).y()-_canvas.layers[id].pos.height()));
+    }
+    if (path.size()==2 && dabs.at(0)==dabs.at(1)) { // single dab
+        path[0] = Magick::Coordinate(path[0].x()-1,
+                                     path[0].y()-1);
+    }
+
+    // apply all dabs in one draw call
+    std::vector<Magick::Drawable> drawable;
+    drawable.push_back(Magick::DrawableFillColor(Magick::Color("none")));
+    drawable.push_back(Magick::DrawablePolyline(path));
+
+    // dirty area of the new dabs in layer coordinates
+    QRectF dirty = Stroke::dabsRect(dabs,
+                                    (_brush->rect().width()/2)+1);
+    QRect layerDirty = dirty.translated(-_canvas.layers[id].pos.width(),
+                                        -_canvas.layers[id].pos.height())
+                       .toAlignedRect();
+    loadChunks(id, layerDirty);
+    Project::markDirty(&_canvas.layers[id], layerDirty);
+    _history->recordTiles(id,
+                          _canvas.layers[id].image,
+                          layerDirty);
+
+    try {
+        Magick::Image &image = _canvas.layers[id].image;
+        image.strokeAntiAlias(_canvas.brushAA);
+        image.strokeLineCap(_canvas.brushLineCap);
+        image.strokeLineJoin(_canvas.brushLineJoin);
+        image.strokeWidth(_brush->rect().width());
+        if (image.colorSpace() == _canvas.image.colorSpace()) {
+            image.strokeColor(_brushNativeColor);
+        } else {
+            image.strokeColor(TransformCache::convertColorNative(_canvas.brushColor,
+                                                                 _brushProfile,
+                                                                 image.iccColorProfile(),
+                                                                 image.colorSpace(),
+                                                                 _brushIntent,
+                                                                 _brushBlackPoint));
         }
+        image.draw(drawable);
+    }
+    catch(Magick::Error &error_ ) { emit errorMessage(error_.what()); }
+    catch(Magick::Warning &warn_ ) { emit warningMessage(warn_.what()); }
 
-        TileItem *item = dynamic_cast<TileItem*>(items.at(i));
+    // only update the area touched by the new dabs
+    handleBrushDirty(dirty);
+}
+
+void View::handleBrushDirty(const QRectF &rect)
+{
+    QRect dirty = rect.toAlignedRect().intersected(QRect(QPoint(0, 0),
+                                                         getCanvasSize()));
+    if (dirty.isEmpty()) { return; }
+    _brushDirty = _brushDirty.united(dirty);
+
+    // wait for the running batch, the new area is picked up when it's done
+    if (_brushWatcher->isRunning()) { return; }
+
+    QRect region = _brushDirty;
+    _brushDirty = QRect();
+
+    // tiles covered by the region
+    QMap<int, QRect> tiles;
+    QMapIterator<int, Common::Tile> i(_canvas.tiles);
+    while (i.hasNext()) {
+        i.next();
+        QRect tileRect = i.value().rect->rect().toAlignedRect();
+        if (!tileRect.intersects(region)) { continue; }
+        tiles[i.key()] = tileRect;
+    }
+    if (tiles.size()==0) { return; }
+
+    // crop canvas and layers to the region, the worker never
+    // shares pixels with the layers we keep painting on
+    Magick::Image canvas;
+    QMap<int, Common::Layer> layers;
+    try {
+        canvas = _image;
+        canvas.crop(Magick::Geometry(static_cast<size_t>(region.width()),
+                                     static_cast<size_t>(region.height()),
+                                     region.x(),
+                                     region.y()));
+        canvas.repage();
+        QMapIterator<int, Common::Layer> layer(_canvas.layers);
+        while (layer.hasNext()) {
+            layer.next();
+            if (!layer.value().visible || !layer.value().image.isValid()) { continue; }
+            QRect layerRect(QPoint(layer.value().pos.width(),
+                                   layer.value().pos.height()),
+                            QSize(static_cast<int>(layer.value().image.columns()),
+                                  static_cast<int>(layer.value().image.rows())));
+            QRect area = layerRect.intersected(region);
+            if (area.isEmpty()) { continue; }
+            Common::Layer crop = layer.value();
+            crop.image.crop(Magick::Geometry(static_cast<size_t>(area.width()),
+                                             static_cast<size_t>(area.height()),
+                                             area.x()-layerRect.x(),
+                                             area.y()-layerRect.y()));
+            crop.image.repage();
+            crop.pos = QSize(area.x()-region.x(),
+                             area.y()-region.y());
+            layers[layer.key()] = crop;
+        }
+    }
+    catch(Magick::Error &error_ ) {
+        emit errorMessage(error_.what());
+        return;
+    }
+    catch(Magick::Warning &warn_ ) { emit warningMessage(warn_.what()); }
+
+    _brushWatcher->setFuture(QtConcurrent::run(this,
+                                               &View::renderRegion,
+                                               region,
+                                               canvas,
+                                               layers,
+                                               tiles));
+}
+
+void View::handleBrushRendered()
+{
+    if (_brushDirty.isEmpty()) { return; }
+    handleBrushDirty(_brushDirty);
+}
+
+void View::syncLayerItems()
+{
+    // match layer items with the restored layers
+    QList<int> found;
+    QList<QGraphicsItem*> items = _scene->items();
+    for (int i=0;i<items.size();++i) {
+        LayerItem *item = dynamic_cast<LayerItem*>(items.at(i));
         if (!item) { continue; }
+        int id = item->getID();
+        if (!_canvas.layers.contains(id)) {
+            _scene->removeItem(item);
+            item->deleteLater();
+            continue;
+        }
+        found.append(id);
+        item->setRect(0,
+                      0,
+                      _canvas.layers[id].image.columns(),
+                      _canvas.layers[id].image.rows());
+        item->setPos(_canvas.layers[id].pos.width(),
+                     _canvas.layers[id].pos.height());
+    }
+    QMapIterator<int, Common::Layer> layers(_canvas.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        if (found.contains(layers.key())) { continue; }
+        addLayer(layers.key(),
+                 QSize(static_cast<int>(layers.value().image.columns()),
+                       static_cast<int>(layers.value().image.rows())),
+                 layers.value().pos,
+                 false);
+    }
 
-        // get tile id
-        int tile=item->data(0).toInt();
+    _image = _canvas.image;
+    updateBrushNativeColor();
+    emit updatedLayers();
+    refreshTiles();
+}
 
-        // get crop
-        Magick::Geometry crop(static_cast<size_t>(_canvas.tileSize.width()),
-                              static_cast<size_t>(_canvas.tileSize.height()),
-                              static_cast<ssize_t>(_canvas.tiles[tile]
-                                                   .rect->boundingRect()
-                                                   .topLeft().x()),
-                              static_cast<ssize_t>(_canvas.tiles[tile]
-                                                   .rect->boundingRect()
-                                                   .topLeft().y()));
+void View::loadNextChunk()
+{
+    if (_chunkWatcher->isRunning() || _projectReleased || _canvas.filename.isEmpty()) { return; }
 
-        // render tile
-        renderTile(tile,
-                   _image,
-                   _canvas.layers,
-                   crop);
+    // visible tiles first, then closest to the center of the viewport
+    QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+    int bestLayer = -1;
+    Common::Chunk best;
+    qreal bestScore = 0;
+    QMapIterator<int, Common::Layer> layers(_canvas.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        const Common::Layer &layer = layers.value();
+        for (int i=0;i<layer.chunks.size();++i) {
+            QRectF rect = QRectF(layer.chunks.at(i).rect)
+                          .translated(layer.pos.width(),
+                                      layer.pos.height());
+            QPointF distance = rect.center()-visible.center();
+            qreal score = distance.x()*distance.x()+distance.y()*distance.y();
+            if (!layer.visible) { score += 2e12; }
+            if (!rect.intersects(visible)) { score += 1e12; }
+            if (bestLayer<0 || score<bestScore) {
+                bestLayer = layers.key();
+                best = layer.chunks.at(i);
+                bestScore = score;
+            }
+        }
+    }
+    if (bestLayer<0) { return; }
+
+    _chunkLayer = bestLayer;
+    _chunk = best;
+    if (!_projectMap) {
+        _chunkWatcher->setFuture(QtConcurrent::run(&Project::readChunk,
+                                                   _canvas.filename,
+                                                   best));
+        return;
+    }
+    _chunkWatcher->setFuture(QtConcurrent::run(&Project::readMappedChunk,
+                                               static_cast<const uchar*>(_projectMap),
+                                               _projectMapSize,
+                                               best));
+}
+
+void View::handleChunkLoaded()
+{
+    int id = _chunkLayer;
+    _chunkLayer = -1;
+    if (_canvas.layers.contains(id)) {
+        int pending = _canvas.layers[id].chunks.size();
+        Project::applyChunk(&_canvas.layers[id],
+                            _chunk,
+                            _chunkWatcher->result());
+        if (_canvas.layers[id].chunks.size() != pending) {
+            handleBrushDirty(QRectF(_chunk.rect)
+                             .translated(_canvas.layers[id].pos.width(),
+                                         _canvas.layers[id].pos.height()));
+        }
+    }
+    loadNextChunk();
+}
+
+void View::loadChunks(int layer,
+                      const QRect &rect)
+{
+    if (!_canvas.layers.contains(layer) ||
+        _canvas.layers[layer].chunks.size()==0) { return; }
+
+    // decode the requested tiles now, they are needed before painting
+    QList<Common::Chunk> chunks = _canvas.layers[layer].chunks;
+    if (_projectMap) {
+        Project::loadChunks(&_canvas.layers[layer],
+                            _projectMap,
+                            _projectMapSize,
+                            rect);
+    } else {
+        Project::loadChunks(&_canvas.layers[layer],
+                            _canvas.filename,
+                            rect);
+    }
+    const QList<Common::Chunk> &pending = _canvas.layers[layer].chunks;
+    for (int i=0;i<chunks.size();++i) {
+        bool loaded = true;
+        for (int y=0;y<pending.size();++y) {
+            if (pending.at(y).offset == chunks.at(i).offset) {
+                loaded = false;
+                break;
+            }
+        }
+        if (!loaded) { continue; }
+        handleBrushDirty(QRectF(chunks.at(i).rect)
+                         .translated(_canvas.layers[layer].pos.width(),
+                                     _canvas.layers[layer].pos.height()));
+    }
+}
+
+void View::loadAllChunks()
+{
+    QList<int> layers = _canvas.layers.keys();
+    for (int i=0;i<layers.size();++i) { loadChunks(layers.at(i)); }
+}
+
+void View::openProjectFile(const QString &filename)
+{
+    // keep the project mapped while we use it, it's released before
+    // the file is replaced (see releaseProjectFile())
+    closeProjectFile();
+    if (filename.isEmpty()) { return; }
+    _projectFile = new QFile(filename, this);
+    if (!_projectFile->open(QIODevice::ReadOnly)) {
+        closeProjectFile();
+        return;
+    }
+    _projectMapSize = _projectFile->size();
+    _projectMap = _projectFile->map(0, _projectMapSize);
+}
+
+void View::closeProjectFile()
+{
+    if (!_projectFile) { return; }
+    if (_projectMap) { _projectFile->unmap(_projectMap); }
+    _projectMap = nullptr;
+    _projectMapSize = 0;
+    _projectFile->close();
+    _projectFile->deleteLater();
+    _projectFile = nullptr;
+}
+
+void View::updateBrushNativeColor()
+{
+    // convert the brush color from the picker profile to the canvas profile,
+    // the transform is cached so this is cheap on every color change
+    _brushNativeColor = TransformCache::convertColorNative(_canvas.brushColor,
+                                                           _brushProfile,
+                                                           _canvas.profile,
+                                                           _canvas.image.colorSpace(),
+                                                           _brushIntent,
+                                                           _brushBlackPoint);
+}
+
+bool View::updateDisplayLut()
+{
+    // the LUT only depends on the profiles, rebuild when any of them changes,
+    // the gamut warning rides along so dirty tiles update it with the composite
+    QByteArray key = DisplayLut::key(_canvas.profile,
+                                     _displayProfile,
+                                     _proofProfile,
+                                     _gamutProfile,
+                                     _displayIntent,
+                                     _displayBlackPoint);
+    if (key == _displayKey) { return false; }
+    DisplayLut::Lut lut = DisplayLut::create(_canvas.profile,
+                                             _displayProfile,
+                                             _proofProfile,
+                                             _gamutProfile,
+                                             _displayIntent,
+                                             _displayBlackPoint);
+    QMutexLocker lock(&_displayMutex);
+    _displayKey = key;
+    _displayLut = lut;
+    return true;
+}
+
+DisplayLut::Lut View::getDisplayLut()
+{
+    QMutexLocker lock(&_displayMutex);
+    return _displayLut;
+}
+
+void View::renderRegion(QRect rect,
+                        Magick::Image canvas,
+                        QMap<int, Common::Layer> layers,
+                        QMap<int, QRect> tiles)
+{
+    if (rect.isEmpty() || layers.size()==0) { return; }
+
+    // comp region once and blit the result into each tile
+    QImage region = renderImage(canvas, layers);
+    if (region.isNull()) { return; }
+
+    QMapIterator<int, QRect> i(tiles);
+    while (i.hasNext()) {
+        i.next();
+        QRect area = i.value().intersected(rect);
+        if (area.isEmpty()) { continue; }
+        emit updateTileRegion(i.key(),
+                              area.topLeft()-i.value().topLeft(),
+                              region.copy(area.translated(-rect.topLeft())));
     }
 }
 
@@ -1059,21 +1705,31 @@ void View::renderTile(int tile, Magick::Image canvas, QMap<int, Common::Layer> l
     if (crop.width()==0 || tile==-1 || layers.size()==0 || canvas.columns()==0) { return; }
 
     // comp tile and write pixmap
-    Magick::Image tmp = Common::compLayers(canvas, layers, crop);
-    tmp.quiet(true);
-    tmp.magick("BMP");
-    Magick::Blob preview;
-    tmp.write(&preview);
+    QImage image = renderImage(canvas, layers, crop);
 
     // update tile pixmap
-    if (preview.length()>0) {
-        QPixmap pix = QPixmap::fromImage(QImage::fromData(reinterpret_cast<uchar*>(const_cast<void*>(preview.data())),
-                                                          static_cast<int>(preview.length())));
+    if (!image.isNull()) {
+        QPixmap pix = QPixmap::fromImage(image);
         if (pix.isNull()) { return; }
         emit updateTilePixmap(tile, pix);
     }
 }
 
+QImage View::renderImage(Magick::Image canvas,
+                         QMap<int, Common::Layer> layers,
+                         Magick::Geometry crop)
+{
+    // comp and map through the display LUT, no intermediate encoding
+    QImage image;
+    try {
+        image = DisplayLut::render(Common::compLayers(canvas, layers, crop),
+                                   getDisplayLut());
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return image;
+}
+
 void View::paintCanvasBackground()
 { // paint a checkerboard background to show transparency in image
     try {
@@ -1099,6 +1755,7 @@ void View::paintCanvasBackground()
 
 void View::moveSelectedLayer(Common::MoveLayer gravity, int skip)
 {
+    if (_readOnly) { return; }
     qDebug() << "move selected layer" << _selectedLayer << gravity;
     for (int i=0;i<_scene->items().size();++i) {
         LayerItem *item = dynamic_cast<LayerItem*>(_scene->items().at(i));
@@ -1135,3 +1792,18 @@ void View::setLockLayers(bool lock)
 {
     emit lockLayers(lock);
 }
+
+void View::setReadOnly(bool readOnly)
+{
+    // pixels are being replaced in the background, refuse edits until done
+    _readOnly = readOnly;
+    if (_readOnly) {
+        if (_stroke.isActive()) { endBrushStroke(); }
+        emit lockLayers(false);
+    } else { emit setDraw(_drawing); }
+}
+
+bool View::isReadOnly()
+{
+    return _readOnly;
+}
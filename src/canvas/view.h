@@ -47,15 +47,24 @@
 #include <QGraphicsSceneMouseEvent>
 #include <QGraphicsPixmapItem>
 #include <QFuture>
+#include <QFutureWatcher>
 #include <QKeyEvent>
+#include <QTimer>
+#include <QFile>
+#include <QMutex>
 
 #include "common.h"
 #include "layeritem.h"
+#include "stroke.h"
+#include "history.h"
+#include "displaylut.h"
 
 #define TILE_Z 6
 #define LAYER_Z 7
 #define BRUSH_Z 100
 
+#define STROKE_FRAME_MS 16
+
 class View : public QGraphicsView
 {
     Q_OBJECT
@@ -89,6 +98,33 @@ private:
     int _selectedLayer;
     QFuture<void> future;
     bool _supportsLayers;
+    Stroke _stroke;
+    QTimer *_strokeTimer;
+    int _strokeLayer;
+    QPointF _strokeLastDab;
+    QRect _brushDirty;
+    QFutureWatcher<void> *_brushWatcher;
+    History *_history;
+    Magick::Blob _brushProfile;
+    Common::RenderingIntent _brushIntent;
+    bool _brushBlackPoint;
+    Magick::Color _brushNativeColor;
+    QFutureWatcher<Magick::Image> *_chunkWatcher;
+    int _chunkLayer;
+    Common::Chunk _chunk;
+    QFile *_projectFile;
+    uchar *_projectMap;
+    qint64 _projectMapSize;
+    bool _projectReleased;
+    Magick::Blob _displayProfile;
+    Magick::Blob _proofProfile;
+    Magick::Blob _gamutProfile;
+    Common::RenderingIntent _displayIntent;
+    bool _displayBlackPoint;
+    QByteArray _displayKey;
+    DisplayLut::Lut _displayLut;
+    QMutex _displayMutex;
+    bool _readOnly;
 
 signals:
 
@@ -98,6 +134,7 @@ signals:
     void myFit(bool value);
 
     void updatedLayers();
+    void updatedHistory();
     void addedLayer(int layer);
     void selectedLayer(int layer);
 
@@ -121,6 +158,9 @@ signals:
 
     void updateTilePixmap(int id,
                           const QPixmap &pix);
+    void updateTileRegion(int id,
+                          const QPoint &offset,
+                          const QImage &image);
 
     void openImages(QList<QUrl> urls);
     void openLayers(QList<QUrl> urls);
@@ -144,7 +184,11 @@ public slots:
     void clearLayers();
     Magick::Image getCanvas();
     QSize getCanvasSize();
-    Common::Canvas getCanvasProject();
+    Common::Canvas getCanvasProject(bool complete = true);
+    void releaseProjectFile();
+    void restoreProjectFile();
+    void setProjectFile(const Common::Canvas &canvas,
+                        bool merge = false);
 
     void setLayerVisibility(int layer,
                             bool layerIsVisible);
@@ -158,11 +202,20 @@ public slots:
 
     Common::Layer getLayer(int layer);
     void setLayer(int layer, Magick::Image image);
+    void setLayerPixels(int layer,
+                        const QRect &rect,
+                        Magick::Image pixels);
+    void setLayerPreview(int layer,
+                         const QRect &rect,
+                         const QImage &preview);
+    void setLayerThumbnail(int layer,
+                           const QImage &thumbnail);
     void setLayerFromCanvas(Common::Canvas canvas,
                             int layer);
     void setLayersFromCanvas(Common::Canvas canvas);
 
-    void updateCanvas(Common::Canvas canvas);
+    void updateCanvas(Common::Canvas canvas,
+                      const QString &action = QString());
 
     QSize getLayerOffset(int layer);
     void setLayerOffset(int layer,
@@ -179,6 +232,8 @@ public slots:
 
     void removeLayer(int layer);
     void setLockLayers(bool lock);
+    void setReadOnly(bool readOnly);
+    bool isReadOnly();
 
     void setCanvasSpecsFromImage(Magick::Image image);
 
@@ -188,6 +243,15 @@ public slots:
 
     void setBrushStroke(int stroke);
     void setBrushColor(const QColor &color);
+    void setBrushColorProfile(const Magick::Blob &profile,
+                              Common::RenderingIntent intent,
+                              bool blackpoint);
+    void setStrokeInterpolation(Stroke::Interpolation mode);
+    void setDisplayProfile(const Magick::Blob &monitor,
+                           const Magick::Blob &proof,
+                           const Magick::Blob &gamut,
+                           Common::RenderingIntent intent,
+                           bool blackpoint);
 
     void setupCanvas(int width = 1024,
                      int height = 1024,
@@ -205,6 +269,15 @@ public slots:
 
     void moveLayerEvent(QKeyEvent *e);
 
+    int getRevision();
+    bool canUndo();
+    bool canRedo();
+    const QString undoLabel();
+    const QString redoLabel();
+    bool undo();
+    bool redo();
+    void clearHistory();
+
 private slots:
 
     void handleLayerMoving(QPointF pos,
@@ -228,13 +301,36 @@ private slots:
                               bool ignoreRunning = false);
     void handleLayerOverTiles(int layer);
     void handleTileStatus();
-    void handleBrushOverTile(QPointF pos,
-                             bool draw = true);
+
+    void beginBrushStroke(QPointF pos);
+    void endBrushStroke();
+    void handleBrushStroke();
+    void handleBrushDirty(const QRectF &rect);
+    void handleBrushRendered();
+    void syncLayerItems();
+    void updateBrushNativeColor();
+    bool updateDisplayLut();
+    DisplayLut::Lut getDisplayLut();
+
+    void loadNextChunk();
+    void handleChunkLoaded();
+    void loadChunks(int layer,
+                    const QRect &rect = QRect());
+    void loadAllChunks();
+    void openProjectFile(const QString &filename);
+    void closeProjectFile();
+    void renderRegion(QRect rect,
+                      Magick::Image canvas,
+                      QMap<int, Common::Layer> layers,
+                      QMap<int, QRect> tiles);
 
     void renderTile(int tile,
                            Magick::Image canvas,
                            QMap<int, Common::Layer> layers,
                            Magick::Geometry crop = Magick::Geometry());
+    QImage renderImage(Magick::Image canvas,
+                       QMap<int, Common::Layer> layers,
+                       Magick::Geometry crop = Magick::Geometry());
 
     void paintCanvasBackground();
 
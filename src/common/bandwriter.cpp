@@ -0,0 +1,315 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "bandwriter.h"
+
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+#include <QDebug>
+
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+#define TIFF_RATIONAL 5
+#define TIFF_UNDEFINED 7
+
+bool BandWriter::supports(const QString &filename)
+{
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    return suffix == "tif" || suffix == "tiff";
+}
+
+bool BandWriter::write(const Common::Canvas &canvas,
+                       const QString &filename,
+                       Magick::Blob profile,
+                       bool compress,
+                       int rows)
+{
+    if (!supports(filename)) { return false; }
+
+    BandWriter::Format format;
+    format.compress = compress;
+    if (!getFormat(canvas, profile, &format)) { return false; }
+    rows = qBound(1, rows, format.height);
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << file.errorString();
+        return false;
+    }
+
+    // header in native byte order, the IFD offset is patched at the end
+    QDataStream stream(&file);
+    stream.setByteOrder(Q_BYTE_ORDER == Q_BIG_ENDIAN ? QDataStream::BigEndian :
+                                                       QDataStream::LittleEndian);
+    stream.writeRawData(Q_BYTE_ORDER == Q_BIG_ENDIAN ? "MM" : "II", 2);
+    stream << quint16(42) << quint32(0);
+
+    // each band is composited, converted and encoded on its own, keep
+    // at most one band per worker in flight and write strips in order
+    QList<QFuture<QByteArray> > bands;
+    QList<quint32> offsets;
+    QList<quint32> counts;
+    int inFlight = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    int y = 0;
+    bool failed = false;
+    while (!failed && (y<format.height || bands.size()>0)) {
+        while (y<format.height && bands.size()<inFlight) {
+            bands.append(QtConcurrent::run(&BandWriter::renderBand,
+                                           canvas,
+                                           profile,
+                                           format,
+                                           y,
+                                           qMin(rows, format.height-y)));
+            y += rows;
+        }
+        QByteArray strip = bands.takeFirst().result();
+        if (strip.isEmpty() ||
+            quint64(file.pos())+quint64(strip.size())>0xFFFFFFFFULL)
+        {
+            qWarning() << "unable to write band to" << filename;
+            failed = true;
+            break;
+        }
+        offsets << quint32(file.pos());
+        counts << quint32(strip.size());
+        failed = file.write(strip) != strip.size();
+    }
+    for (int i=0;i<bands.size();++i) { bands[i].waitForFinished(); }
+
+    if (failed || !writeDirectory(&file, format, rows, offsets, counts)) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool BandWriter::getFormat(const Common::Canvas &canvas,
+                           Magick::Blob profile,
+                           BandWriter::Format *format)
+{
+    if (!format) { return false; }
+
+    // a single converted pixel tells us what every band will look like
+    Magick::Image sample;
+    try {
+        format->width = static_cast<int>(canvas.image.columns());
+        format->height = static_cast<int>(canvas.image.rows());
+        format->alpha = canvas.image.alpha();
+        format->bits = canvas.image.depth()>8 ? 16 : 8;
+        format->density = canvas.image.density();
+        if (canvas.image.resolutionUnits() == Magick::PixelsPerCentimeterResolution) {
+            format->unit = 3;
+        }
+        sample = canvas.image;
+        sample.quiet(true);
+        sample.crop(Magick::Geometry(1, 1, 0, 0));
+        sample.repage();
+    }
+    catch(Magick::Error &error_ ) {
+        qWarning() << error_.what();
+        return false;
+    }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    if (format->width<1 || format->height<1) { return false; }
+
+    format->profile = canvas.profile;
+    if (profile.length()>0) {
+        sample = Common::convertColorspace(sample,
+                                           canvas.profile,
+                                           profile);
+        if (!sample.isValid()) { return false; }
+        format->profile = profile;
+    }
+
+    switch (sample.colorSpace()) {
+    case Magick::CMYKColorspace:
+        format->map = "CMYK";
+        format->photometric = 5;
+        break;
+    case Magick::GRAYColorspace:
+    case Magick::LinearGRAYColorspace:
+        format->map = "I";
+        format->photometric = 1;
+        break;
+    default:
+        format->map = "RGB";
+        format->photometric = 2;
+    }
+    if (format->alpha) { format->map += "A"; }
+    format->samples = static_cast<int>(format->map.size());
+    format->storage = format->bits == 16 ? Magick::ShortPixel : Magick::CharPixel;
+    return true;
+}
+
+QByteArray BandWriter::renderBand(const Common::Canvas &canvas,
+                                  const Magick::Blob &profile,
+                                  const BandWriter::Format &format,
+                                  int y,
+                                  int rows)
+{
+    Magick::Image band = Common::compLayers(canvas.image,
+                                            canvas.layers,
+                                            Magick::Geometry(static_cast<size_t>(format.width),
+                                                             static_cast<size_t>(rows),
+                                                             0,
+                                                             y));
+    if (profile.length()>0) {
+        band = Common::convertColorspace(band,
+                                         canvas.profile,
+                                         profile);
+    }
+    if (!band.isValid() ||
+        band.columns() != static_cast<size_t>(format.width) ||
+        band.rows() != static_cast<size_t>(rows)) { return QByteArray(); }
+
+    QByteArray data(format.width*rows*format.samples*(format.bits/8), 0);
+    try {
+        band.write(0,
+                   0,
+                   static_cast<size_t>(format.width),
+                   static_cast<size_t>(rows),
+                   format.map,
+                   format.storage,
+                   data.data());
+    }
+    catch(Magick::Error &error_ ) {
+        qWarning() << error_.what();
+        return QByteArray();
+    }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+
+    // a TIFF deflate strip is a plain zlib stream, qCompress only
+    // prepends the uncompressed size
+    if (format.compress) { return qCompress(data).mid(4); }
+    return data;
+}
+
+bool BandWriter::writeDirectory(QIODevice *device,
+                                const BandWriter::Format &format,
+                                int rows,
+                                const QList<quint32> &offsets,
+                                const QList<quint32> &counts)
+{
+    if (!device || offsets.size() != counts.size()) { return false; }
+
+    QDataStream::ByteOrder order = Q_BYTE_ORDER == Q_BIG_ENDIAN ? QDataStream::BigEndian :
+                                                                  QDataStream::LittleEndian;
+    struct Entry
+    {
+        quint16 tag;
+        quint16 type;
+        quint32 count;
+        QByteArray value;
+    };
+    QList<Entry> entries;
+    auto add = [&entries, order](quint16 tag,
+                                 quint16 type,
+                                 QList<quint32> values) {
+        QByteArray value;
+        QDataStream stream(&value, QIODevice::WriteOnly);
+        stream.setByteOrder(order);
+        for (int i=0;i<values.size();++i) {
+            if (type == TIFF_SHORT) { stream << quint16(values.at(i)); }
+            else { stream << values.at(i); }
+        }
+        Entry entry = {tag, type, quint32(type == TIFF_RATIONAL ? values.size()/2 : values.size()), value};
+        entries << entry;
+    };
+
+    QList<quint32> bits;
+    for (int i=0;i<format.samples;++i) { bits << quint32(format.bits); }
+
+    // tags must be sorted
+    add(256, TIFF_LONG, QList<quint32>() << quint32(format.width));
+    add(257, TIFF_LONG, QList<quint32>() << quint32(format.height));
+    add(258, TIFF_SHORT, bits);
+    add(259, TIFF_SHORT, QList<quint32>() << (format.compress ? 8 : 1));
+    add(262, TIFF_SHORT, QList<quint32>() << quint32(format.photometric));
+    add(273, TIFF_LONG, offsets);
+    add(277, TIFF_SHORT, QList<quint32>() << quint32(format.samples));
+    add(278, TIFF_LONG, QList<quint32>() << quint32(rows));
+    add(279, TIFF_LONG, counts);
+    if (format.density.x()>0 && format.density.y()>0) {
+        add(282, TIFF_RATIONAL, QList<quint32>() << quint32(qRound(format.density.x()*100)) << 100);
+        add(283, TIFF_RATIONAL, QList<quint32>() << quint32(qRound(format.density.y()*100)) << 100);
+    }
+    add(284, TIFF_SHORT, QList<quint32>() << 1);
+    if (format.density.x()>0 && format.density.y()>0) {
+        add(296, TIFF_SHORT, QList<quint32>() << quint32(format.unit));
+    }
+    if (format.photometric == 5) { add(332, TIFF_SHORT, QList<quint32>() << 1); }
+    if (format.alpha) { add(338, TIFF_SHORT, QList<quint32>() << 2); }
+    if (format.profile.length()>0) {
+        Entry entry = {34675,
+                       TIFF_UNDEFINED,
+                       quint32(format.profile.length()),
+                       QByteArray(static_cast<const char*>(format.profile.data()),
+                                  static_cast<int>(format.profile.length()))};
+        entries << entry;
+    }
+
+    // IFD on a word boundary, values that don't fit follow it
+    if (device->pos()%2 != 0 && device->write("\0", 1) != 1) { return false; }
+    quint64 ifd = quint64(device->pos());
+    quint64 extra = ifd+2+quint64(entries.size())*12+4;
+    QByteArray values;
+    QByteArray directory;
+    QDataStream stream(&directory, QIODevice::WriteOnly);
+    stream.setByteOrder(order);
+    stream << quint16(entries.size());
+    for (int i=0;i<entries.size();++i) {
+        const Entry &entry = entries.at(i);
+        stream << entry.tag << entry.type << entry.count;
+        if (entry.value.size()<=4) {
+            QByteArray value = entry.value;
+            value.append(QByteArray(4-value.size(), '\0'));
+            stream.writeRawData(value.constData(), 4);
+        } else {
+            stream << quint32(extra+quint64(values.size()));
+            values.append(entry.value);
+            if (values.size()%2 != 0) { values.append('\0'); }
+        }
+    }
+    stream << quint32(0);
+    if (extra+quint64(values.size())>0xFFFFFFFFULL) { return false; }
+
+    if (device->write(directory) != directory.size() ||
+        device->write(values) != values.size() ||
+        !device->seek(4)) { return false; }
+    QDataStream header(device);
+    header.setByteOrder(order);
+    header << quint32(ifd);
+    return header.status() == QDataStream::Ok;
+}
@@ -0,0 +1,89 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef BANDWRITER_H
+#define BANDWRITER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QIODevice>
+
+#include "common.h"
+
+#define BANDWRITER_ROWS 256
+
+class BandWriter
+{
+public:
+
+    struct Format
+    {
+        int width = 0;
+        int height = 0;
+        int samples = 0;
+        int bits = 8;
+        int photometric = 2;
+        bool alpha = false;
+        bool compress = false;
+        std::string map;
+        Magick::StorageType storage = Magick::CharPixel;
+        Magick::Blob profile;
+        Magick::Point density;
+        int unit = 2;
+    };
+
+    static bool supports(const QString &filename);
+    static bool write(const Common::Canvas &canvas,
+                      const QString &filename,
+                      Magick::Blob profile = Magick::Blob(),
+                      bool compress = false,
+                      int rows = BANDWRITER_ROWS);
+
+private:
+
+    static bool getFormat(const Common::Canvas &canvas,
+                          Magick::Blob profile,
+                          BandWriter::Format *format);
+    static QByteArray renderBand(const Common::Canvas &canvas,
+                                 const Magick::Blob &profile,
+                                 const BandWriter::Format &format,
+                                 int y,
+                                 int rows);
+    static bool writeDirectory(QIODevice *device,
+                               const BandWriter::Format &format,
+                               int rows,
+                               const QList<quint32> &offsets,
+                               const QList<quint32> &counts);
+};
+
+#endif // BANDWRITER_H
@@ -0,0 +1,376 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "colorengine.h"
+#include "profileregistry.h"
+
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+#include <QDebug>
+
+Magick::Image ColorEngine::convertImage(Magick::Image image,
+                                        const Magick::Blob &input,
+                                        const Magick::Blob &output,
+                                        Common::RenderingIntent intent,
+                                        bool blackpoint)
+{
+    // nothing to do between identical profiles
+    if (input.length()>0 &&
+        TransformCache::profileHash(input) == TransformCache::profileHash(output)) { return image; }
+
+    // an invalid image means not handled here, let ImageMagick do it
+    QList<ColorEngine::Target> targets;
+    ColorEngine::Target target;
+    if (!prepare(image, input, output, intent, blackpoint, &target)) { return Magick::Image(); }
+    targets << target;
+    target = ColorEngine::Target();
+    if (!run(&targets, ColorEngine::Progress())) { return Magick::Image(); }
+    return targets.first().result;
+}
+
+Common::Canvas ColorEngine::convertCanvas(Common::Canvas canvas,
+                                          const Magick::Blob &output,
+                                          Common::RenderingIntent intent,
+                                          bool blackpoint,
+                                          ColorEngine::Progress progress)
+{
+    if (output.length()==0) { return canvas; }
+    Magick::Blob input = canvas.profile.length()>0 ? canvas.profile : canvas.image.iccColorProfile();
+    if (input.length()>0 &&
+        TransformCache::profileHash(input) == TransformCache::profileHash(output)) { return canvas; }
+
+    // the canvas and every layer are sliced into bands that are all
+    // converted together, images lcms can't handle are done after
+    QList<int> keys;
+    QList<ColorEngine::Target> targets;
+    QList<int> fallback;
+    QList<int> layers = canvas.layers.keys();
+    for (int i=-1;i<layers.size();++i) {
+        Magick::Image image = i<0 ? canvas.image : canvas.layers.value(layers.at(i)).image;
+        ColorEngine::Target target;
+        if (prepare(image, input, output, intent, blackpoint, &target)) {
+            keys << i;
+            targets << target;
+        } else { fallback << i; }
+    }
+    int slices = 0;
+    for (int i=0;i<targets.size();++i) {
+        slices += static_cast<int>((targets.at(i).source.rows()+COLORENGINE_BAND_ROWS-1)/COLORENGINE_BAND_ROWS);
+    }
+    if (!run(&targets, progress, fallback.size())) {
+        for (int i=0;i<keys.size();++i) { fallback << keys.at(i); }
+        keys.clear();
+        targets.clear();
+    }
+
+    for (int i=0;i<keys.size();++i) {
+        if (keys.at(i)<0) { canvas.image = targets.at(i).result; }
+        else { canvas.layers[layers.at(keys.at(i))].image = targets.at(i).result; }
+    }
+    targets.clear();
+
+    for (int i=0;i<fallback.size();++i) {
+        int key = fallback.at(i);
+        if (key<0) {
+            canvas.image = Common::convertColorspace(canvas.image,
+                                                     input,
+                                                     output);
+        } else {
+            canvas.layers[layers.at(key)].image = Common::convertColorspace(canvas.layers.value(layers.at(key)).image,
+                                                                            input,
+                                                                            output);
+        }
+        if (progress) { progress(100*(slices+i+1)/(slices+fallback.size())); }
+    }
+
+    canvas.profile = ProfileRegistry::intern(canvas.image.iccColorProfile());
+    return canvas;
+}
+
+bool ColorEngine::prepare(Magick::Image image,
+                          const Magick::Blob &input,
+                          const Magick::Blob &output,
+                          Common::RenderingIntent intent,
+                          bool blackpoint,
+                          ColorEngine::Target *target)
+{
+    if (!target ||
+        !image.isValid() ||
+        input.length()==0 ||
+        output.length()==0) { return false; }
+
+    cmsColorSpaceSignature inputSpace = TransformCache::profileColorspace(input);
+    cmsColorSpaceSignature outputSpace = TransformCache::profileColorspace(output);
+    std::string inputMap = pixelMap(inputSpace);
+    std::string outputMap = pixelMap(outputSpace);
+    if (inputMap.empty() || outputMap.empty()) { return false; }
+
+    // the pixels must already be in the input profile's colorspace
+    cmsColorSpaceSignature imageSpace;
+    switch (image.colorSpace()) {
+    case Magick::CMYKColorspace:
+        imageSpace = cmsSigCmykData;
+        break;
+    case Magick::GRAYColorspace:
+    case Magick::LinearGRAYColorspace:
+        imageSpace = cmsSigGrayData;
+        break;
+    case Magick::sRGBColorspace:
+    case Magick::RGBColorspace:
+        imageSpace = cmsSigRgbData;
+        break;
+    default:
+        return false;
+    }
+    if (imageSpace != inputSpace) { return false; }
+
+    bool alpha = image.alpha();
+    cmsUInt32Number flags = 0;
+    if (alpha) {
+#ifdef cmsFLAGS_COPY_ALPHA
+        flags = cmsFLAGS_COPY_ALPHA;
+        inputMap += "A";
+        outputMap += "A";
+#else
+        return false;
+#endif
+    }
+
+    // one transform per profile pair, intent and black point, shared
+    // by every band of every layer
+    TransformCache::Transform transform = TransformCache::getTransform(input,
+                                                                       output,
+                                                                       pixelFormat(inputSpace, alpha),
+                                                                       pixelFormat(outputSpace, alpha),
+                                                                       intent,
+                                                                       blackpoint,
+                                                                       flags);
+    if (!transform) { return false; }
+
+    Magick::Image result;
+    try {
+        image.quiet(true);
+        result = Magick::Image(Magick::Geometry(image.columns(), image.rows()),
+                               Magick::Color(0, 0, 0));
+        result.quiet(true);
+        switch (outputSpace) {
+        case cmsSigCmykData:
+            result.colorSpaceType(Magick::CMYKColorspace);
+            break;
+        case cmsSigGrayData:
+            result.colorSpaceType(Magick::GRAYColorspace);
+            break;
+        default:;
+        }
+        if (alpha) { result.alpha(true); }
+        result.depth(image.depth());
+        result.modifyImage();
+        MagickCore::CloneImageProperties(result.image(), image.constImage());
+    }
+    catch(Magick::Error &error_ ) {
+        qWarning() << error_.what();
+        return false;
+    }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+
+    target->source = image;
+    target->result = result;
+    target->profile = output;
+    target->inputMap = inputMap;
+    target->outputMap = outputMap;
+    target->transform = transform;
+    return true;
+}
+
+bool ColorEngine::run(QList<ColorEngine::Target> *targets,
+                      ColorEngine::Progress progress,
+                      int extra)
+{
+    if (!targets) { return false; }
+
+    QList<ColorEngine::Slice> slices;
+    for (int i=0;i<targets->size();++i) {
+        const ColorEngine::Target &target = targets->at(i);
+        size_t height = target.source.rows();
+        for (size_t y=0;y<height;y+=COLORENGINE_BAND_ROWS) {
+            ColorEngine::Slice slice;
+            slice.target = i;
+            slice.source = target.source;
+            slice.inputMap = target.inputMap;
+            slice.outputChannels = static_cast<int>(target.outputMap.size());
+            slice.transform = target.transform;
+            slice.y = y;
+            slice.rows = qMin(static_cast<size_t>(COLORENGINE_BAND_ROWS), height-y);
+            slices << slice;
+        }
+    }
+
+    // bands are converted on the pool, at most one per worker in
+    // flight, and copied into the result on this thread
+    QList<ColorEngine::Slice> queued;
+    QList<QFuture<QVector<quint16> > > converted;
+    int inFlight = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    int total = slices.size()+extra;
+    int done = 0;
+    bool failed = false;
+    while (!failed && (slices.size()>0 || queued.size()>0)) {
+        while (slices.size()>0 && queued.size()<inFlight) {
+            queued << slices.takeFirst();
+            converted << QtConcurrent::run(&ColorEngine::convertSlice,
+                                           queued.last());
+        }
+        ColorEngine::Slice slice = queued.takeFirst();
+        QVector<quint16> pixels = converted.takeFirst().result();
+        failed = pixels.isEmpty() ||
+                 !importSlice(&(*targets)[slice.target], slice, pixels);
+        done++;
+        if (progress && total>0) { progress(100*done/total); }
+    }
+    for (int i=0;i<converted.size();++i) { converted[i].waitForFinished(); }
+    if (failed) {
+        qWarning() << "color conversion failed";
+        return false;
+    }
+
+    for (int i=0;i<targets->size();++i) {
+        ColorEngine::Target &target = (*targets)[i];
+        target.source = Magick::Image();
+        try { target.result.profile("ICC", target.profile); }
+        catch(Magick::Error &error_ ) {
+            qWarning() << error_.what();
+            return false;
+        }
+        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    }
+    return true;
+}
+
+QVector<quint16> ColorEngine::convertSlice(const ColorEngine::Slice &slice)
+{
+    QVector<quint16> result;
+    size_t width = slice.source.columns();
+    QVector<quint16> source(static_cast<int>(width*slice.rows*slice.inputMap.size()));
+    try {
+        // cropping reads through its own cache view, safe to do from
+        // several threads on the same source
+        Magick::Image band(slice.source);
+        band.quiet(true);
+        band.crop(Magick::Geometry(width,
+                                   slice.rows,
+                                   0,
+                                   static_cast<ssize_t>(slice.y)));
+        band.repage();
+        band.write(0,
+                   0,
+                   width,
+                   slice.rows,
+                   slice.inputMap,
+                   Magick::ShortPixel,
+                   source.data());
+    }
+    catch(Magick::Error &error_ ) {
+        qWarning() << error_.what();
+        return result;
+    }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+
+    result.resize(static_cast<int>(width*slice.rows)*slice.outputChannels);
+#if LCMS_VERSION >= 2080
+    cmsUInt32Number stride = static_cast<cmsUInt32Number>(width*sizeof(quint16));
+    cmsDoTransformLineStride(slice.transform.data(),
+                             source.constData(),
+                             result.data(),
+                             static_cast<cmsUInt32Number>(width),
+                             static_cast<cmsUInt32Number>(slice.rows),
+                             stride*static_cast<cmsUInt32Number>(slice.inputMap.size()),
+                             stride*static_cast<cmsUInt32Number>(slice.outputChannels),
+                             0,
+                             0);
+#else
+    cmsDoTransform(slice.transform.data(),
+                   source.constData(),
+                   result.data(),
+                   static_cast<cmsUInt32Number>(width*slice.rows));
+#endif
+    return result;
+}
+
+bool ColorEngine::importSlice(ColorEngine::Target *target,
+                              const ColorEngine::Slice &slice,
+                              const QVector<quint16> &pixels)
+{
+    if (!target) { return false; }
+    target->result.modifyImage();
+    MagickCore::ExceptionInfo *exception = MagickCore::AcquireExceptionInfo();
+    bool imported = MagickCore::ImportImagePixels(target->result.image(),
+                                                  0,
+                                                  static_cast<ssize_t>(slice.y),
+                                                  target->result.columns(),
+                                                  slice.rows,
+                                                  target->outputMap.c_str(),
+                                                  MagickCore::ShortPixel,
+                                                  pixels.constData(),
+                                                  exception) != MagickCore::MagickFalse;
+    if (exception->severity>=MagickCore::ErrorException) {
+        qWarning() << exception->reason;
+        imported = false;
+    }
+    MagickCore::DestroyExceptionInfo(exception);
+    return imported;
+}
+
+const std::string ColorEngine::pixelMap(cmsColorSpaceSignature signature)
+{
+    switch (signature) {
+    case cmsSigCmykData:
+        return std::string("CMYK");
+    case cmsSigGrayData:
+        return std::string("I");
+    case cmsSigRgbData:
+        return std::string("RGB");
+    default:;
+    }
+    return std::string();
+}
+
+cmsUInt32Number ColorEngine::pixelFormat(cmsColorSpaceSignature signature,
+                                         bool alpha)
+{
+    switch (signature) {
+    case cmsSigCmykData:
+        return alpha ? (COLORSPACE_SH(PT_CMYK)|EXTRA_SH(1)|CHANNELS_SH(4)|BYTES_SH(2)) : TYPE_CMYK_16;
+    case cmsSigGrayData:
+        return alpha ? TYPE_GRAYA_16 : TYPE_GRAY_16;
+    default:;
+    }
+    return alpha ? TYPE_RGBA_16 : TYPE_RGB_16;
+}
@@ -0,0 +1,104 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef COLORENGINE_H
+#define COLORENGINE_H
+
+#include <QList>
+#include <QVector>
+
+#include <functional>
+
+#include "common.h"
+#include "transformcache.h"
+
+#define COLORENGINE_BAND_ROWS 256
+
+class ColorEngine
+{
+public:
+
+    typedef std::function<void(int percent)> Progress;
+
+    static Magick::Image convertImage(Magick::Image image,
+                                      const Magick::Blob &input,
+                                      const Magick::Blob &output,
+                                      Common::RenderingIntent intent = Common::PerceptualRenderingIntent,
+                                      bool blackpoint = true);
+    static Common::Canvas convertCanvas(Common::Canvas canvas,
+                                        const Magick::Blob &output,
+                                        Common::RenderingIntent intent = Common::PerceptualRenderingIntent,
+                                        bool blackpoint = true,
+                                        ColorEngine::Progress progress = ColorEngine::Progress());
+
+private:
+
+    struct Target
+    {
+        Magick::Image source;
+        Magick::Image result;
+        Magick::Blob profile;
+        std::string inputMap;
+        std::string outputMap;
+        TransformCache::Transform transform;
+    };
+
+    struct Slice
+    {
+        int target;
+        Magick::Image source;
+        std::string inputMap;
+        int outputChannels;
+        TransformCache::Transform transform;
+        size_t y;
+        size_t rows;
+    };
+
+    static bool prepare(Magick::Image image,
+                        const Magick::Blob &input,
+                        const Magick::Blob &output,
+                        Common::RenderingIntent intent,
+                        bool blackpoint,
+                        ColorEngine::Target *target);
+    static bool run(QList<ColorEngine::Target> *targets,
+                    ColorEngine::Progress progress,
+                    int extra = 0);
+    static QVector<quint16> convertSlice(const ColorEngine::Slice &slice);
+    static bool importSlice(ColorEngine::Target *target,
+                            const ColorEngine::Slice &slice,
+                            const QVector<quint16> &pixels);
+    static const std::string pixelMap(cmsColorSpaceSignature signature);
+    static cmsUInt32Number pixelFormat(cmsColorSpaceSignature signature,
+                                       bool alpha);
+};
+
+#endif // COLORENGINE_H
@@ -31,12 +31,22 @@
 */
 
 #include "common.h"
+#include "project.h"
+#include "bandwriter.h"
+#include "sniffer.h"
+#include "colorengine.h"
+#include "transformcache.h"
+#include "profilecatalog.h"
+#include "profileregistry.h"
 
 #include <QDebug>
 #include <QFile>
 #include <QDir>
-#include <QDirIterator>
+#include <QFileInfo>
 #include <QAction>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrent>
 
 //#include <magick/Magick.h>
 
@@ -316,6 +326,7 @@ void Common::setDiskResource(int gib)
     }
     catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
     catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    setMapResource();
 }
 
 int Common::getMemoryResource()
@@ -327,10 +338,34 @@ void Common::setMemoryResource(int gib)
 {
     try {
         Magick::ResourceLimits::memory(static_cast<qulonglong>(gib)*static_cast<qulonglong>(RESOURCE_BYTE));
-        Magick::ResourceLimits::map(static_cast<qulonglong>(gib)*static_cast<qulonglong>(RESOURCE_BYTE));
     }
     catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
     catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    setMapResource();
+}
+
+void Common::setMapResource()
+{
+    // images larger than the memory limit get a file-backed memory-mapped
+    // pixel cache, paged in and out by the OS, up to the disk limit,
+    // the area limit sends a single image there once its pixels
+    // (up to CMYKA) would not fit in memory on their own
+    try {
+        qulonglong memory = Magick::ResourceLimits::memory();
+        qulonglong disk = Magick::ResourceLimits::disk();
+        Magick::ResourceLimits::map(disk>memory?disk:memory);
+        Magick::ResourceLimits::area(qMax<qulonglong>(1, memory/(5*sizeof(MagickCore::Quantum))));
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+}
+
+const QString Common::cachePath()
+{
+    QString path = QString("%1/pixelcache")
+                   .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+    QDir().mkpath(path);
+    return path;
 }
 
 void Common::setThreadResources(int thread)
@@ -345,162 +380,155 @@ bool Common::writeCanvas(Common::Canvas canvas,
 {
     if (filename.isEmpty() || !canvas.image.isValid()) { return false; }
 
-    // setup project
-    std::list<Magick::Image> images;
-    Magick::Image image(canvas.image);
-    image.magick("MIFF");
-
-    // set label on image
-    try {
-        image.label(canvas.label.toStdString());
+    // a MIFF list is just the images written one after another, so each
+    // worker tags and encodes a single image and every result is written
+    // as soon as it's next in line, at most one image per worker in flight
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << file.errorString();
+        return false;
     }
-    catch(Magick::Error &error_ ) {
-        qWarning() << error_.what();
+    QList<int> layers = canvas.layers.keys();
+    QList<QFuture<QByteArray> > encoded;
+    int inFlight = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    int next = -1; // canvas first, then layers
+    bool failed = false;
+    while (!failed && (next<layers.size() || encoded.size()>0)) {
+        while (next<layers.size() && encoded.size()<inFlight) {
+            if (next<0) {
+                encoded.append(QtConcurrent::run(&Common::encodeCanvas,
+                                                 canvas.image,
+                                                 canvas.label,
+                                                 canvas.profile,
+                                                 compress));
+            } else {
+                encoded.append(QtConcurrent::run(&Common::encodeLayer,
+                                                 canvas.layers.value(layers.at(next)),
+                                                 compress));
+            }
+            ++next;
+        }
+        QByteArray blob = encoded.takeFirst().result();
+        failed = blob.isEmpty() || file.write(blob) != blob.size();
+    }
+    for (int i=0;i<encoded.size();++i) { encoded[i].waitForFinished(); }
+    if (failed) {
+        qWarning() << "failed to write project" << filename;
+        file.cancelWriting();
         return false;
     }
-    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return file.commit();
+}
 
-    // mark as cyan project
+QByteArray Common::encodeCanvas(Magick::Image image,
+                                const QString &label,
+                                const Magick::Blob &profile,
+                                Magick::CompressionType compress)
+{
     try {
+        image.magick("MIFF");
+
+        // set label on image
+        image.label(label.toStdString());
+
+        // mark as cyan project
         image.attribute(QString(CYAN_PROJECT).toStdString(),
                         QString("%1").arg(CYAN_PROJECT_VERSION)
                         .toStdString());
-    }
-    catch(Magick::Error &error_ ) {
-        qWarning() << error_.what();
-        return false;
-    }
-    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
 
-    // compress(?)
-    try { image.compressType(compress); }
-    catch(Magick::Error &error_ ) {
-        qWarning() << error_.what();
-        return false;
-    }
-    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        // compress(?)
+        image.compressType(compress);
+
+        // add color profile
+        image.profile("ICC", profile);
 
-    // add color profile
-    try { image.profile("ICC", canvas.profile); }
+        image.backgroundColor(Magick::ColorRGB(1, 1, 1)); // workaround issue in IM
+        image.alpha(false); // workaround issue in IM
+        image.alpha(true); // workaround issue in IM
+    }
     catch(Magick::Error &error_ ) {
         qWarning() << error_.what();
-        return false;
+        return QByteArray();
     }
     catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return encodeImage(image);
+}
 
-    // add canvas as first image
-    image.backgroundColor(Magick::ColorRGB(1, 1, 1)); // workaround issue in IM
-    image.alpha(false); // workaround issue in IM
-    image.alpha(true); // workaround issue in IM
-    images.push_back(image);
-
-    // add layers
-    QMapIterator<int, Common::Layer> layers(canvas.layers);
-    while (layers.hasNext()) {
-        layers.next();
-        Magick::Image layer(layers.value().image);
-        layer.magick("MIFF");
+QByteArray Common::encodeLayer(Common::Layer layer,
+                               Magick::CompressionType compress)
+{
+    Magick::Image image(layer.image);
+    layer.image = Magick::Image();
+    try {
+        image.magick("MIFF");
 
         // add label
-        try {
-            layer.label(layers.value().label.toStdString());
-        }
-        catch(Magick::Error &error_ ) {
-            qWarning() << error_.what();
-            return false;
-        }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        image.label(layer.label.toStdString());
 
         // add position
-        try {
-            layer.attribute(QString(CYAN_LAYER_X).toStdString(),
-                            QString("%1").arg(layers.value().pos.width())
-                            .toStdString());
-            layer.attribute(QString(CYAN_LAYER_Y).toStdString(),
-                            QString("%1").arg(layers.value().pos.height())
-                            .toStdString());
-        }
-        catch(Magick::Error &error_ ) {
-            qWarning() << error_.what();
-            return false;
-        }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        image.attribute(QString(CYAN_LAYER_X).toStdString(),
+                        QString("%1").arg(layer.pos.width())
+                        .toStdString());
+        image.attribute(QString(CYAN_LAYER_Y).toStdString(),
+                        QString("%1").arg(layer.pos.height())
+                        .toStdString());
 
         // mark as cyan layer
-        try {
-            layer.attribute(QString(CYAN_LAYER).toStdString(),
-                            QString("%1").arg(CYAN_LAYER_VERSION)
-                            .toStdString());
-        }
-        catch(Magick::Error &error_ ) {
-            qWarning() << error_.what();
-            return false;
-        }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        image.attribute(QString(CYAN_LAYER).toStdString(),
+                        QString("%1").arg(CYAN_LAYER_VERSION)
+                        .toStdString());
 
         // add compose mode
-        try {
-            layer.attribute(QString(CYAN_LAYER_COMPOSE).toStdString(),
-                            QString("%1").arg(Common::compositeModes()[layers.value().composite])
-                            .toStdString());
-        }
-        catch(Magick::Error &error_ ) {
-            qWarning() << error_.what();
-            return false;
-        }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        image.attribute(QString(CYAN_LAYER_COMPOSE).toStdString(),
+                        QString("%1").arg(Common::compositeModes()[layer.composite])
+                        .toStdString());
 
         // add visibility
-        try {
-            layer.attribute(QString(CYAN_LAYER_VISIBILITY).toStdString(),
-                            QString("%1").arg(layers.value().visible)
-                            .toStdString());
-        }
-        catch(Magick::Error &error_ ) {
-            qWarning() << error_.what();
-            return false;
-        }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        image.attribute(QString(CYAN_LAYER_VISIBILITY).toStdString(),
+                        QString("%1").arg(layer.visible)
+                        .toStdString());
 
         // add opacity
-        try {
-            layer.attribute(QString(CYAN_LAYER_OPACITY).toStdString(),
-                            QString("%1").arg(layers.value().opacity)
-                            .toStdString());
-        }
-        catch(Magick::Error &error_ ) {
-            qWarning() << error_.what();
-            return false;
-        }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        image.attribute(QString(CYAN_LAYER_OPACITY).toStdString(),
+                        QString("%1").arg(layer.opacity)
+                        .toStdString());
 
         // compress(?)
-        try { layer.compressType(compress); }
-        catch(Magick::Error &error_ ) {
-            qWarning() << error_.what();
-            return false;
-        }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
-
-        // add to project
-        images.push_back(layer);
-    }
-
-    // write project file
-    try {
-        Magick::writeImages(images.begin(),
-                            images.end(),
-                            filename.toStdString());
+        image.compressType(compress);
     }
     catch(Magick::Error &error_ ) {
         qWarning() << error_.what();
-        return false;
+        return QByteArray();
     }
     catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return encodeImage(image);
+}
 
-    if (QFile::exists(filename)) { return true; }
-    // TODO add more checks
-    return false;
+QByteArray Common::encodeImage(Magick::Image image)
+{
+    QByteArray data;
+    try {
+        Magick::Blob blob;
+        image.write(&blob);
+        data = QByteArray(static_cast<const char*>(blob.data()),
+                          static_cast<int>(blob.length()));
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return data;
+}
+
+void Common::prepareLayer(Common::Layer &layer)
+{
+    // decompress
+    try { layer.image.compressType(Magick::NoCompression); }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+
+    // strip
+    try { layer.image.strip(); }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
 }
 
 Common::Canvas Common::readCanvas(const QString &filename)
@@ -533,7 +561,7 @@ Common::Canvas Common::readCanvas(const QString &filename)
             canvas.label = QString::fromStdString(it->label());
 
             //set profile
-            canvas.profile = canvas.image.iccColorProfile();
+            canvas.profile = ProfileRegistry::intern(canvas.image.iccColorProfile());
             continue;
         }
         double layer = QString::fromStdString(it->attribute(QString(CYAN_LAYER)
@@ -571,7 +599,7 @@ Common::Canvas Common::readCanvas(const QString &filename)
                 layer.image.iccColorProfile().length()>0)
             {
                 qWarning() << "CANVAS PROFILE IS EMPTY! ADD FALLBACK FROM LAYER!";
-                canvas.profile = layer.image.iccColorProfile();
+                canvas.profile = ProfileRegistry::intern(layer.image.iccColorProfile());
                 try {
                     canvas.image.profile("ICC", canvas.profile);
                 }
@@ -579,19 +607,15 @@ Common::Canvas Common::readCanvas(const QString &filename)
                 catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
             }*/
 
-            // decompress
-            try { layer.image.compressType(Magick::NoCompression); }
-            catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
-            catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
-
-            // strip
-            layer.image.strip();
-
             // add
             canvas.layers.insert(canvas.layers.size(),
                                  layer);
         }
     }
+
+    // post-process layers in parallel
+    QtConcurrent::blockingMap(canvas.layers,
+                              &Common::prepareLayer);
     return canvas;
 }
 
@@ -607,6 +631,14 @@ bool Common::renderCanvasToFile(Common::Canvas canvas,
                                 QMap<QString, QString> attr,
                                 QMap<QString, QString> arti)
 {
+    // TIFF is written band by band, never holding the whole composite
+    if (attr.isEmpty() && arti.isEmpty() && BandWriter::supports(filename)) {
+        return BandWriter::write(canvas,
+                                 filename,
+                                 Magick::Blob(),
+                                 compress != Magick::NoCompression);
+    }
+
     // render canvas
     Magick::Image image = Common::compLayers(canvas.image,
                                              canvas.layers);
@@ -656,19 +688,9 @@ bool Common::renderCanvasToFile(Common::Canvas canvas,
 
 bool Common::isValidCanvas(const QString &filename)
 {
-    if (filename.isEmpty()) { return false; }
-
-    try {
-        Magick::Image image;
-        image.quiet(true);
-        image.ping(filename.toStdString());
-        double project = QString::fromStdString(image.attribute(QString(CYAN_PROJECT)
-                                                                .toStdString())).toDouble();
-        if (project>0) { return true; }
-    }
-    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
-    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
-    return false;
+    // classified from the file header, cached by path, size and mtime
+    Sniffer::FileType type = Sniffer::classify(filename).type;
+    return type == Sniffer::ProjectFile || type == Sniffer::CanvasFile;
 }
 
 bool Common::isValidImage(const QString &filename)
@@ -725,6 +747,49 @@ Magick::Image Common::convertColorspace(Magick::Image image,
                                         Magick::RenderingIntent intent,
                                         bool blackpoint)
 {
+    // convert through a cached lcms transform when we know the source,
+    // ImageMagick would build a new transform for every image
+    Magick::Blob source = input.length()>0 ? input : image.iccColorProfile();
+
+    // same profile in and out, leave the pixels alone like ImageMagick did
+    if (output.length()>0 && source.length()>0 &&
+        TransformCache::profileHash(source) == TransformCache::profileHash(output))
+    {
+        try {
+            if (image.iccColorProfile().length()==0) { image.iccColorProfile(output); }
+        }
+        catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        return image;
+    }
+
+    if (output.length()>0 && source.length()>0) {
+        Common::RenderingIntent lcmsIntent;
+        switch (intent) {
+        case Magick::SaturationIntent:
+            lcmsIntent = Common::SaturationRenderingIntent;
+            break;
+        case Magick::AbsoluteIntent:
+            lcmsIntent = Common::AbsoluteRenderingIntent;
+            break;
+        case Magick::RelativeIntent:
+            lcmsIntent = Common::RelativeRenderingIntent;
+            break;
+        default:
+            lcmsIntent = Common::PerceptualRenderingIntent;
+        }
+        Magick::Image converted = ColorEngine::convertImage(image,
+                                                            source,
+                                                            output,
+                                                            lcmsIntent,
+                                                            blackpoint);
+        if (converted.isValid()) {
+            converted.renderingIntent(intent);
+            converted.blackPointCompensation(blackpoint);
+            return converted;
+        }
+    }
+
     if (output.length()>0) {
         try {
             image.quiet(true);
@@ -745,23 +810,16 @@ Magick::Image Common::convertColorspace(Magick::Image image,
                                         Magick::RenderingIntent intent,
                                         bool blackpoint)
 {
-    Magick::Blob blob1,blob2;
-    Magick::Image readBlob1,readBlob2;
-    try {
-        readBlob1.read(input.toStdString());
-        readBlob1.write(&blob1);
-        readBlob2.read(output.toStdString());
-        readBlob2.write(&blob2);
-        if (blob1.length()>0 && blob2.length()>0) {
-            return convertColorspace(image,
-                                     blob1,
-                                     blob2,
-                                     intent,
-                                     blackpoint);
-        }
+    // profiles are read once and shared through the registry
+    Magick::Blob blob1 = ProfileRegistry::blob(input);
+    Magick::Blob blob2 = ProfileRegistry::blob(output);
+    if (blob1.length()>0 && blob2.length()>0) {
+        return convertColorspace(image,
+                                 blob1,
+                                 blob2,
+                                 intent,
+                                 blackpoint);
     }
-    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
-    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
     return Magick::Image();
 }
 
@@ -771,21 +829,14 @@ Magick::Image Common::convertColorspace(Magick::Image image,
                                         Magick::RenderingIntent intent,
                                         bool blackpoint)
 {
-    Magick::Blob blob;
-    Magick::Image readBlob;
-    try {
-        readBlob.read(output.toStdString());
-        readBlob.write(&blob);
-        if (blob.length()>0) {
-            return convertColorspace(image,
-                                     input,
-                                     blob,
-                                     intent,
-                                     blackpoint);
-        }
+    Magick::Blob blob = ProfileRegistry::blob(output);
+    if (blob.length()>0) {
+        return convertColorspace(image,
+                                 input,
+                                 blob,
+                                 intent,
+                                 blackpoint);
     }
-    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
-    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
     return Magick::Image();
 }
 
@@ -795,21 +846,14 @@ Magick::Image Common::convertColorspace(Magick::Image image,
                                         Magick::RenderingIntent intent,
                                         bool blackpoint)
 {
-    Magick::Blob blob;
-    Magick::Image readBlob;
-    try {
-        readBlob.read(input.toStdString());
-        readBlob.write(&blob);
-        if (blob.length()>0) {
-            return convertColorspace(image,
-                                     blob,
-                                     output,
-                                     intent,
-                                     blackpoint);
-        }
+    Magick::Blob blob = ProfileRegistry::blob(input);
+    if (blob.length()>0) {
+        return convertColorspace(image,
+                                 blob,
+                                 output,
+                                 intent,
+                                 blackpoint);
     }
-    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
-    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
     return Magick::Image();
 }
 
@@ -829,19 +873,11 @@ QStringList Common::getColorProfilesPath()
 
 QMap<QString, QString> Common::getColorProfiles(Magick::ColorspaceType colorspace)
 {
+    // served from the on-disk catalog, only changed profiles are opened
     QMap<QString, QString> output;
-    QStringList folders = getColorProfilesPath();
-    for (int i = 0; i < folders.size(); ++i) {
-        QStringList filter;
-        filter << "*.icc" << "*.icm";
-        QDirIterator it(folders.at(i), filter, QDir::Files, QDirIterator::Subdirectories);
-        while (it.hasNext()) {
-            QString iccFile = it.next();
-            QString profile = getProfileTag(iccFile);
-            if (iccFile.isEmpty() || profile.isEmpty()) { continue; }
-            if (getProfileColorspace(iccFile)!= colorspace) { continue; }
-            output[profile] = iccFile;
-        }
+    QList<ProfileCatalog::Entry> profiles = ProfileCatalog::profiles(colorspace);
+    for (int i=0;i<profiles.size();++i) {
+        output[profiles.at(i).description] = profiles.at(i).filename;
     }
     return output;
 }
@@ -950,6 +986,7 @@ const QString Common::supportedWriteFormats()
 const QString Common::supportedReadFormats()
 {
     QString result;
+    result.append(QString("*.%1 ").arg(CYAN_PROJECT_SUFFIX));
     result.append(QString("*.miff "));
     result.append(QString("*.xcf "));
     result.append(QString("*.psd "));
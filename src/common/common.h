@@ -36,7 +36,9 @@
 #include <QObject>
 #include <QMap>
 #include <QDateTime>
+#include <QRect>
 #include <QMenu>
+#include <QImage>
 
 #include <list>
 #include <lcms2.h>
@@ -114,15 +116,25 @@ public:
         TileItem *rect;
     };
 
+    struct Chunk
+    {
+        QRect rect;
+        qint64 offset = 0;
+        qint64 size = 0;
+    };
+
     struct Layer
     {
         Magick::Image image;
+        QList<Common::Chunk> chunks; // not decoded yet
+        QList<Common::Chunk> saved; // unchanged since last save
         QMap<int, Common::Layer> layers;
         Magick::CompositeOperator composite = Magick::OverCompositeOp;
         QSize pos = QSize(0, 0);
         bool visible = true;
         double opacity = 1.0;
         QString label = QObject::tr("New Layer");
+        QImage thumbnail; // stored in the project, cleared on change
     };
 
     struct Canvas
@@ -140,6 +152,8 @@ public:
         Magick::LineJoin brushLineJoin = Magick::MiterJoin;
         QString timestamp;
         Magick::Blob profile;
+        QString filename;
+        QImage preview; // flattened, stored in the project
     };
 
     Common(QObject *parent = nullptr);
@@ -161,12 +175,23 @@ public:
     static int getMemoryResource();
     static void setMemoryResource(int gib);
 
+    static void setMapResource();
+    static const QString cachePath();
+
     static void setThreadResources(int thread);
 
     static bool writeCanvas(Common::Canvas canvas,
                             const QString &filename,
                             Magick::CompressionType compress = Magick::LZMACompression);
     static Common::Canvas readCanvas(const QString &filename);
+    static QByteArray encodeCanvas(Magick::Image image,
+                                   const QString &label,
+                                   const Magick::Blob &profile,
+                                   Magick::CompressionType compress);
+    static QByteArray encodeLayer(Common::Layer layer,
+                                  Magick::CompressionType compress);
+    static QByteArray encodeImage(Magick::Image image);
+    static void prepareLayer(Common::Layer &layer);
 
     static Magick::Image renderCanvasToImage(Common::Canvas canvas);
     static bool renderCanvasToFile(Common::Canvas canvas,
@@ -0,0 +1,465 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "displaylut.h"
+#include "transformcache.h"
+
+#include <QDebug>
+
+#define DISPLAYLUT_BAND_ROWS 64
+#define DISPLAYLUT_GAMUT_ALARM 0x0000, 0xffff, 0x0000 // Lab black with full chroma
+
+static inline void tetrahedral(const quint16 *p,
+                               int sx,
+                               int sy,
+                               int sz,
+                               int fx,
+                               int fy,
+                               int fz,
+                               int *out)
+{
+    // pick the tetrahedron holding the point by ordering the fractions,
+    // then blend its four corners, weights always add up to 256
+    int o1, o2, f1, f2, f3;
+    if (fx >= fy) {
+        if (fy >= fz) { o1 = sx; o2 = sx+sy; f1 = fx; f2 = fy; f3 = fz; }
+        else if (fx >= fz) { o1 = sx; o2 = sx+sz; f1 = fx; f2 = fz; f3 = fy; }
+        else { o1 = sz; o2 = sx+sz; f1 = fz; f2 = fx; f3 = fy; }
+    } else {
+        if (fz >= fy) { o1 = sz; o2 = sy+sz; f1 = fz; f2 = fy; f3 = fx; }
+        else if (fz >= fx) { o1 = sy; o2 = sy+sz; f1 = fy; f2 = fz; f3 = fx; }
+        else { o1 = sy; o2 = sx+sy; f1 = fy; f2 = fx; f3 = fz; }
+    }
+    const int o3 = sx+sy+sz;
+    const int w0 = 256-f1;
+    const int w1 = f1-f2;
+    const int w2 = f2-f3;
+    for (int c=0;c<3;++c) {
+        out[c] = p[c]*w0 + p[o1+c]*w1 + p[o2+c]*w2 + p[o3+c]*f3;
+    }
+}
+
+DisplayLut::DisplayLut() :
+    _signature(cmsSigRgbData)
+  , _inputs(3)
+  , _grid(DISPLAYLUT_GRID)
+  , _gamutContext(nullptr)
+  , _gamutTransform(nullptr)
+{
+}
+
+DisplayLut::~DisplayLut()
+{
+    if (_gamutTransform) { cmsDeleteTransform(_gamutTransform); }
+    if (_gamutContext) { cmsDeleteContext(_gamutContext); }
+}
+
+DisplayLut::Lut DisplayLut::create(const Magick::Blob &source,
+                                   const Magick::Blob &monitor,
+                                   const Magick::Blob &proof,
+                                   const Magick::Blob &gamut,
+                                   Common::RenderingIntent intent,
+                                   bool blackpoint)
+{
+    cmsHPROFILE inputProfile = openProfile(source);
+    cmsHPROFILE outputProfile = openProfile(monitor);
+    cmsHPROFILE proofProfile = proof.length()>0 ? openProfile(proof) : nullptr;
+
+    QSharedPointer<DisplayLut> lut(new DisplayLut());
+    cmsUInt32Number inputFormat = TYPE_RGB_16;
+    if (inputProfile) {
+        lut->_signature = cmsGetColorSpace(inputProfile);
+        switch (lut->_signature) {
+        case cmsSigCmykData:
+            lut->_inputs = 4;
+            lut->_grid = DISPLAYLUT_GRID_CMYK;
+            inputFormat = TYPE_CMYK_16;
+            break;
+        case cmsSigGrayData:
+            lut->_inputs = 1;
+            lut->_grid = DISPLAYLUT_GRID_GRAY;
+            inputFormat = TYPE_GRAY_16;
+            break;
+        case cmsSigRgbData:
+            break;
+        default:
+            lut.clear();
+        }
+    }
+
+    // canvas -> (proof) -> monitor, the proof device is simulated on screen
+    cmsHTRANSFORM transform = nullptr;
+    if (lut && inputProfile && outputProfile &&
+        cmsGetColorSpace(outputProfile) == cmsSigRgbData &&
+        (proof.length()==0 || proofProfile))
+    {
+        cmsUInt32Number flags = blackpoint ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0;
+        if (proofProfile) {
+            transform = cmsCreateProofingTransform(inputProfile,
+                                                   inputFormat,
+                                                   outputProfile,
+                                                   TYPE_RGB_16,
+                                                   proofProfile,
+                                                   TransformCache::lcmsIntent(intent),
+                                                   INTENT_RELATIVE_COLORIMETRIC,
+                                                   flags|cmsFLAGS_SOFTPROOFING);
+        } else {
+            transform = cmsCreateTransform(inputProfile,
+                                           inputFormat,
+                                           outputProfile,
+                                           TYPE_RGB_16,
+                                           TransformCache::lcmsIntent(intent),
+                                           flags);
+        }
+    }
+
+    if (inputProfile) { cmsCloseProfile(inputProfile); }
+    if (outputProfile) { cmsCloseProfile(outputProfile); }
+    if (proofProfile) { cmsCloseProfile(proofProfile); }
+    if (!transform) {
+        qWarning() << "failed to create display transform";
+        return DisplayLut::Lut();
+    }
+
+    // sample the transform once on a regular lattice, last channel varies fastest
+    const int grid = lut->_grid;
+    const int inputs = lut->_inputs;
+    int points = 1;
+    for (int i=0;i<inputs;++i) { points *= grid; }
+    QVector<quint16> lattice(points*inputs);
+    for (int i=0;i<points;++i) {
+        int rest = i;
+        for (int c=inputs-1;c>=0;--c) {
+            lattice[i*inputs+c] = static_cast<quint16>((rest%grid)*65535/(grid-1));
+            rest /= grid;
+        }
+    }
+    lut->_table.resize(points*3);
+    cmsDoTransform(transform,
+                   lattice.constData(),
+                   lut->_table.data(),
+                   static_cast<cmsUInt32Number>(points));
+    cmsDeleteTransform(transform);
+
+    // gamut check against the output device in a private lcms context so the
+    // alarm codes never reach other transforms, the output is Lab where the
+    // alarm can't be produced by a real color, kept for exact checks later
+    if (gamut.length()>0) {
+        lut->_gamutContext = cmsCreateContext(nullptr, nullptr);
+        cmsHPROFILE gamutInput = openProfile(source, lut->_gamutContext);
+        cmsHPROFILE gamutLab = cmsCreateLab4ProfileTHR(lut->_gamutContext, nullptr);
+        cmsHPROFILE gamutProfile = openProfile(gamut, lut->_gamutContext);
+        if (lut->_gamutContext && gamutInput && gamutLab && gamutProfile) {
+            cmsUInt16Number alarm[cmsMAXCHANNELS] = { DISPLAYLUT_GAMUT_ALARM };
+            cmsSetAlarmCodesTHR(lut->_gamutContext, alarm);
+            lut->_gamutTransform = cmsCreateProofingTransformTHR(lut->_gamutContext,
+                                                                 gamutInput,
+                                                                 inputFormat,
+                                                                 gamutLab,
+                                                                 TYPE_Lab_16,
+                                                                 gamutProfile,
+                                                                 TransformCache::lcmsIntent(intent),
+                                                                 INTENT_RELATIVE_COLORIMETRIC,
+                                                                 cmsFLAGS_GAMUTCHECK|cmsFLAGS_NOCACHE);
+        }
+        if (gamutInput) { cmsCloseProfile(gamutInput); }
+        if (gamutLab) { cmsCloseProfile(gamutLab); }
+        if (gamutProfile) { cmsCloseProfile(gamutProfile); }
+        if (!lut->_gamutTransform) { qWarning() << "failed to create gamut check transform"; }
+    }
+
+    // one out of gamut flag per lattice point, and the offsets of the
+    // corners of a lattice cell
+    if (lut->_gamutTransform) {
+        QVector<quint16> checked(points*3);
+        cmsDoTransform(lut->_gamutTransform,
+                       lattice.constData(),
+                       checked.data(),
+                       static_cast<cmsUInt32Number>(points));
+        lut->_gamut.resize(points);
+        for (int i=0;i<points;++i) {
+            lut->_gamut[i] = isAlarm(checked.constData()+i*3) ? 1 : 0;
+        }
+        for (int corner=0;corner<(1<<inputs);++corner) {
+            int offset = 0;
+            int stride = 1;
+            for (int c=inputs-1;c>=0;--c) {
+                if (corner&(1<<c)) { offset += stride; }
+                stride *= grid;
+            }
+            lut->_corners.append(offset);
+        }
+    }
+
+    // lattice cell and 8-bit fraction for every 16-bit input value
+    lut->_index.resize(65536);
+    for (int v=0;v<65536;++v) {
+        quint64 pos = static_cast<quint64>(v)*static_cast<quint64>(grid-1)*256/65535;
+        quint32 cell = static_cast<quint32>(pos>>8);
+        quint32 frac = static_cast<quint32>(pos&255);
+        if (cell >= static_cast<quint32>(grid-1)) {
+            cell = static_cast<quint32>(grid-2);
+            frac = 256;
+        }
+        lut->_index[v] = (cell<<16)|frac;
+    }
+
+    return lut;
+}
+
+const QByteArray DisplayLut::key(const Magick::Blob &source,
+                                 const Magick::Blob &monitor,
+                                 const Magick::Blob &proof,
+                                 const Magick::Blob &gamut,
+                                 Common::RenderingIntent intent,
+                                 bool blackpoint)
+{
+    QByteArray key = TransformCache::profileHash(source);
+    key.append(TransformCache::profileHash(monitor));
+    key.append(proof.length()>0 ? TransformCache::profileHash(proof) : QByteArray("none"));
+    key.append(gamut.length()>0 ? TransformCache::profileHash(gamut) : QByteArray("none"));
+    key.append(':');
+    key.append(QByteArray::number(TransformCache::lcmsIntent(intent)));
+    key.append(':');
+    key.append(blackpoint ? '1' : '0');
+    return key;
+}
+
+QImage DisplayLut::render(Magick::Image image,
+                          const DisplayLut::Lut &lut)
+{
+    const int width = static_cast<int>(image.columns());
+    const int height = static_cast<int>(image.rows());
+    if (width==0 || height==0) { return QImage(); }
+    const bool alpha = image.alpha();
+
+    try {
+        image.quiet(true);
+        if (!lut || !lut->accepts(image.colorSpace())) {
+            // no display transform, hand the pixels over as they are
+            QImage result(width, height, QImage::Format_RGBA8888);
+            if (result.isNull()) { return QImage(); }
+            image.write(0,
+                        0,
+                        static_cast<size_t>(width),
+                        static_cast<size_t>(height),
+                        "RGBA",
+                        Magick::CharPixel,
+                        result.bits());
+            return result;
+        }
+
+        // export 16-bit bands and map them straight into the scanlines
+        std::string map = lut->pixelMap();
+        if (alpha) { map.append("A"); }
+        const int channels = static_cast<int>(map.size());
+        const int rows = qMin(height, DISPLAYLUT_BAND_ROWS);
+        QImage result(width,
+                      height,
+                      alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+        if (result.isNull()) { return QImage(); }
+        QVector<quint16> pixels(width*rows*channels);
+        for (int y=0;y<height;y+=rows) {
+            const int band = qMin(rows, height-y);
+            image.write(0,
+                        y,
+                        static_cast<size_t>(width),
+                        static_cast<size_t>(band),
+                        map,
+                        Magick::ShortPixel,
+                        pixels.data());
+            for (int row=0;row<band;++row) {
+                lut->mapRow(pixels.constData()+row*width*channels,
+                            width,
+                            alpha,
+                            reinterpret_cast<QRgb*>(result.scanLine(y+row)));
+            }
+        }
+        return result;
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return QImage();
+}
+
+bool DisplayLut::accepts(Magick::ColorspaceType colorspace) const
+{
+    switch (colorspace) {
+    case Magick::CMYKColorspace:
+        return _signature == cmsSigCmykData;
+    case Magick::GRAYColorspace:
+        return _signature == cmsSigGrayData;
+    default:;
+    }
+    return _signature == cmsSigRgbData;
+}
+
+cmsHPROFILE DisplayLut::openProfile(const Magick::Blob &profile,
+                                    cmsContext context)
+{
+    // use the built-in sRGB when no profile is available
+    if (profile.length()==0) { return cmsCreate_sRGBProfileTHR(context); }
+    return cmsOpenProfileFromMemTHR(context,
+                                    profile.data(),
+                                    static_cast<cmsUInt32Number>(profile.length()));
+}
+
+bool DisplayLut::isAlarm(const quint16 *lab)
+{
+    static const quint16 alarm[3] = { DISPLAYLUT_GAMUT_ALARM };
+    return lab[0] == alarm[0] && lab[1] == alarm[1] && lab[2] == alarm[2];
+}
+
+const std::string DisplayLut::pixelMap() const
+{
+    switch (_signature) {
+    case cmsSigCmykData:
+        return std::string("CMYK");
+    case cmsSigGrayData:
+        return std::string("I");
+    default:;
+    }
+    return std::string("RGB");
+}
+
+void DisplayLut::mapRow(const quint16 *src,
+                        int width,
+                        bool alpha,
+                        QRgb *dst) const
+{
+    const quint16 *table = _table.constData();
+    const quint32 *index = _index.constData();
+    const int step = _inputs+(alpha ? 1 : 0);
+    const int sz = 3;
+    const int sy = _grid*sz;
+    const int sx = _grid*sy;
+    const quint8 *gamut = _gamut.isEmpty() ? nullptr : _gamut.constData();
+    const int corners = _corners.size();
+    QRgb *first = dst;
+    QVector<int> probed;
+    QVector<quint16> probes;
+    int out[3];
+    int next[3];
+
+    for (int x=0;x<width;++x,src+=step) {
+        switch (_inputs) {
+        case 1:
+        {
+            const quint32 v = index[src[0]];
+            const quint16 *p = table+(v>>16)*3;
+            const int f = static_cast<int>(v&0x1ff);
+            for (int c=0;c<3;++c) { out[c] = p[c]*(256-f) + p[3+c]*f; }
+            break;
+        }
+        case 4:
+        {
+            // tetrahedral in CMY on both neighbouring K slices, linear in K
+            const quint32 c = index[src[0]];
+            const quint32 m = index[src[1]];
+            const quint32 y = index[src[2]];
+            const quint32 k = index[src[3]];
+            const quint16 *p = table+((((c>>16)*_grid+(m>>16))*_grid+(y>>16))*_grid+(k>>16))*3;
+            tetrahedral(p,
+                        sx*_grid,
+                        sy*_grid,
+                        sz*_grid,
+                        static_cast<int>(c&0x1ff),
+                        static_cast<int>(m&0x1ff),
+                        static_cast<int>(y&0x1ff),
+                        out);
+            const int fk = static_cast<int>(k&0x1ff);
+            if (fk>0) {
+                tetrahedral(p+3,
+                            sx*_grid,
+                            sy*_grid,
+                            sz*_grid,
+                            static_cast<int>(c&0x1ff),
+                            static_cast<int>(m&0x1ff),
+                            static_cast<int>(y&0x1ff),
+                            next);
+                for (int i=0;i<3;++i) {
+                    out[i] = (out[i]>>8)*(256-fk) + (next[i]>>8)*fk;
+                }
+            }
+            break;
+        }
+        default:
+        {
+            const quint32 r = index[src[0]];
+            const quint32 g = index[src[1]];
+            const quint32 b = index[src[2]];
+            const quint16 *p = table+(((r>>16)*_grid+(g>>16))*_grid+(b>>16))*3;
+            tetrahedral(p,
+                        sx,
+                        sy,
+                        sz,
+                        static_cast<int>(r&0x1ff),
+                        static_cast<int>(g&0x1ff),
+                        static_cast<int>(b&0x1ff),
+                        out);
+        }
+        }
+        if (gamut) {
+            // a cell whose corners agree is decided by the lattice, pixels
+            // in cells crossing the gamut boundary are checked exactly below
+            int point = 0;
+            for (int c=0;c<_inputs;++c) { point = point*_grid+static_cast<int>(index[src[c]]>>16); }
+            int flagged = 0;
+            for (int i=0;i<corners;++i) { flagged += gamut[point+_corners.at(i)]; }
+            if (flagged==corners) {
+                out[0] = out[1] = out[2] = DISPLAYLUT_GAMUT_WARNING<<16;
+            } else if (flagged>0) {
+                probed.append(x);
+                for (int c=0;c<_inputs;++c) { probes.append(src[c]); }
+            }
+        }
+        *dst++ = qRgba(out[0]>>16,
+                       out[1]>>16,
+                       out[2]>>16,
+                       alpha ? src[_inputs]>>8 : 255);
+    }
+
+    if (probed.isEmpty()) { return; }
+    QVector<quint16> checked(probed.size()*3);
+    cmsDoTransform(_gamutTransform,
+                   probes.constData(),
+                   checked.data(),
+                   static_cast<cmsUInt32Number>(probed.size()));
+    for (int i=0;i<probed.size();++i) {
+        if (!isAlarm(checked.constData()+i*3)) { continue; }
+        QRgb &pixel = first[probed.at(i)];
+        pixel = qRgba(DISPLAYLUT_GAMUT_WARNING,
+                      DISPLAYLUT_GAMUT_WARNING,
+                      DISPLAYLUT_GAMUT_WARNING,
+                      qAlpha(pixel));
+    }
+}
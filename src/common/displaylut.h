@@ -0,0 +1,101 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef DISPLAYLUT_H
+#define DISPLAYLUT_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+#include <QSharedPointer>
+
+#include <lcms2.h>
+
+#include "common.h"
+
+#define DISPLAYLUT_GRID 33
+#define DISPLAYLUT_GRID_CMYK 17
+#define DISPLAYLUT_GRID_GRAY 256
+#define DISPLAYLUT_GAMUT_WARNING 128
+
+class DisplayLut
+{
+public:
+
+    // built once per view and profile change, read by every tile worker
+    typedef QSharedPointer<const DisplayLut> Lut;
+
+    static DisplayLut::Lut create(const Magick::Blob &source,
+                                  const Magick::Blob &monitor,
+                                  const Magick::Blob &proof = Magick::Blob(),
+                                  const Magick::Blob &gamut = Magick::Blob(),
+                                  Common::RenderingIntent intent = Common::PerceptualRenderingIntent,
+                                  bool blackpoint = true);
+    static const QByteArray key(const Magick::Blob &source,
+                                const Magick::Blob &monitor,
+                                const Magick::Blob &proof,
+                                const Magick::Blob &gamut,
+                                Common::RenderingIntent intent,
+                                bool blackpoint);
+    static QImage render(Magick::Image image,
+                         const DisplayLut::Lut &lut = DisplayLut::Lut());
+
+    ~DisplayLut();
+
+    bool accepts(Magick::ColorspaceType colorspace) const;
+
+private:
+
+    DisplayLut();
+    Q_DISABLE_COPY(DisplayLut)
+
+    cmsColorSpaceSignature _signature;
+    int _inputs;
+    int _grid;
+    QVector<quint16> _table;
+    QVector<quint32> _index;
+    QVector<quint8> _gamut;
+    QVector<int> _corners;
+    cmsContext _gamutContext;
+    cmsHTRANSFORM _gamutTransform;
+
+    static cmsHPROFILE openProfile(const Magick::Blob &profile,
+                                   cmsContext context = nullptr);
+    static bool isAlarm(const quint16 *lab);
+    const std::string pixelMap() const;
+    void mapRow(const quint16 *src,
+                int width,
+                bool alpha,
+                QRgb *dst) const;
+};
+
+#endif // DISPLAYLUT_H
@@ -0,0 +1,582 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "history.h"
+#include "project.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrent>
+
+int History::_memoryLimit = HISTORY_MEMORY_LIMIT;
+
+History::History(QObject *parent) : QObject(parent)
+  , _recording(false)
+  , _lastID(0)
+  , _revision(0)
+  , _compressor(nullptr)
+  , _spilling(false)
+{
+    _spillPath = QString("%1/history/%2")
+                 .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
+                 .arg(Common::timestamp());
+
+    _compressor = new QFutureWatcher<History::Entry>(this);
+    connect(_compressor, SIGNAL(finished()),
+            this, SLOT(handleCompressed()));
+}
+
+History::~History()
+{
+    _compressor->waitForFinished();
+    clear();
+    QDir(_spillPath).removeRecursively();
+}
+
+int History::getMemoryLimit()
+{
+    return _memoryLimit;
+}
+
+void History::setMemoryLimit(int mib)
+{
+    if (mib<1) { mib = HISTORY_MEMORY_LIMIT; }
+    _memoryLimit = mib;
+}
+
+int History::getRevision()
+{
+    return _revision;
+}
+
+void History::touch()
+{
+    // changes that are not recorded, like layer properties
+    _revision++;
+}
+
+bool History::canUndo()
+{
+    return _undo.size()>0;
+}
+
+bool History::canRedo()
+{
+    return _redo.size()>0;
+}
+
+const QString History::undoLabel()
+{
+    if (!canUndo()) { return QString(); }
+    return _undo.last().label;
+}
+
+const QString History::redoLabel()
+{
+    if (!canRedo()) { return QString(); }
+    return _redo.last().label;
+}
+
+bool History::undo(Common::Canvas *canvas)
+{
+    if (!canvas || !canUndo() || _recording) { return false; }
+    History::Entry entry = _undo.takeLast();
+    apply(entry, canvas, true);
+    _redo.append(entry);
+    _revision++;
+    return true;
+}
+
+bool History::redo(Common::Canvas *canvas)
+{
+    if (!canvas || !canRedo() || _recording) { return false; }
+    History::Entry entry = _redo.takeLast();
+    apply(entry, canvas, false);
+    _undo.append(entry);
+    _revision++;
+    return true;
+}
+
+void History::clear()
+{
+    for (int i=0;i<_undo.size();++i) { removeFiles(_undo.at(i)); }
+    for (int i=0;i<_redo.size();++i) { removeFiles(_redo.at(i)); }
+    _undo.clear();
+    _redo.clear();
+    _pending = History::Entry();
+    _pendingTiles.clear();
+    _recording = false;
+}
+
+void History::beginTiles(const QString &label)
+{
+    _pending = History::Entry();
+    _pending.label = label;
+    _pendingTiles.clear();
+    _recording = true;
+}
+
+void History::recordTiles(int layer,
+                          Magick::Image image,
+                          const QRect &rect)
+{
+    if (!_recording || !image.isValid()) { return; }
+
+    QRect bounds(0,
+                 0,
+                 static_cast<int>(image.columns()),
+                 static_cast<int>(image.rows()));
+    QRect area = rect.intersected(bounds);
+    if (area.isEmpty()) { return; }
+
+    // save the tiles not already saved in this step, before they are modified
+    int tilesX = (static_cast<int>(image.columns())+HISTORY_TILE_SIZE-1)/HISTORY_TILE_SIZE;
+    for (int y=area.top()/HISTORY_TILE_SIZE;y<=area.bottom()/HISTORY_TILE_SIZE;++y) {
+        for (int x=area.left()/HISTORY_TILE_SIZE;x<=area.right()/HISTORY_TILE_SIZE;++x) {
+            quint64 key = (static_cast<quint64>(layer)<<32)|static_cast<quint64>(y*tilesX+x);
+            if (_pendingTiles.contains(key)) { continue; }
+            _pendingTiles.insert(key);
+
+            QRect cell = QRect(x*HISTORY_TILE_SIZE,
+                               y*HISTORY_TILE_SIZE,
+                               HISTORY_TILE_SIZE,
+                               HISTORY_TILE_SIZE).intersected(bounds);
+            History::TileDelta tile;
+            tile.layer = layer;
+            tile.pos = cell.topLeft();
+            try {
+                tile.before.image = image;
+                tile.before.image.crop(Magick::Geometry(static_cast<size_t>(cell.width()),
+                                                        static_cast<size_t>(cell.height()),
+                                                        cell.x(),
+                                                        cell.y()));
+                tile.before.image.repage();
+                tile.before.image.strip();
+            }
+            catch(Magick::Error &error_ ) {
+                qWarning() << error_.what();
+                continue;
+            }
+            catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+            _pending.tiles.append(tile);
+        }
+    }
+}
+
+void History::commitTiles(const Common::Canvas &canvas)
+{
+    if (!_recording) { return; }
+    _recording = false;
+    _pendingTiles.clear();
+
+    // save the tiles after they were modified
+    for (int i=0;i<_pending.tiles.size();++i) {
+        History::TileDelta &tile = _pending.tiles[i];
+        if (!canvas.layers.contains(tile.layer)) { continue; }
+        try {
+            tile.after.image = canvas.layers[tile.layer].image;
+            tile.after.image.crop(Magick::Geometry(tile.before.image.columns(),
+                                                   tile.before.image.rows(),
+                                                   tile.pos.x(),
+                                                   tile.pos.y()));
+            tile.after.image.repage();
+            tile.after.image.strip();
+        }
+        catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    }
+    if (_pending.tiles.size()==0) { return; }
+    push(_pending);
+    _pending = History::Entry();
+}
+
+void History::recordAddLayer(int id,
+                             const Common::Layer &layer)
+{
+    History::Entry entry;
+    entry.label = tr("Add layer");
+    History::LayerDelta delta;
+    delta.hasLayer = true;
+    delta.after = layer;
+    delta.after.image = Magick::Image();
+    delta.afterPixels.image = layer.image;
+    entry.layers[id] = delta;
+    push(entry);
+}
+
+void History::recordRemoveLayer(int id,
+                                const Common::Layer &layer)
+{
+    History::Entry entry;
+    entry.label = tr("Remove layer");
+    History::LayerDelta delta;
+    delta.hadLayer = true;
+    delta.before = layer;
+    delta.before.image = Magick::Image();
+    delta.beforePixels.image = layer.image;
+    entry.layers[id] = delta;
+    push(entry);
+}
+
+void History::recordCanvas(const QString &label,
+                           const Common::Canvas &before,
+                           const Common::Canvas &after)
+{
+    // images are shared with the canvas, nothing is copied until compressed
+    History::Entry entry;
+    entry.label = label;
+    entry.hasCanvas = true;
+    entry.canvasBefore.image = before.image;
+    entry.canvasAfter.image = after.image;
+    entry.profileBefore = before.profile;
+    entry.profileAfter = after.profile;
+
+    QList<int> ids = before.layers.keys();
+    QList<int> afterIDs = after.layers.keys();
+    for (int i=0;i<afterIDs.size();++i) {
+        if (!ids.contains(afterIDs.at(i))) { ids.append(afterIDs.at(i)); }
+    }
+    for (int i=0;i<ids.size();++i) {
+        int id = ids.at(i);
+        History::LayerDelta delta;
+        delta.hadLayer = before.layers.contains(id);
+        delta.hasLayer = after.layers.contains(id);
+        if (delta.hadLayer) {
+            delta.before = before.layers[id];
+            delta.beforePixels.image = delta.before.image;
+            delta.before.image = Magick::Image();
+        }
+        if (delta.hasLayer) {
+            delta.after = after.layers[id];
+            delta.afterPixels.image = delta.after.image;
+            delta.after.image = Magick::Image();
+        }
+        entry.layers[id] = delta;
+    }
+    push(entry);
+}
+
+void History::push(History::Entry entry)
+{
+    entry.id = ++_lastID;
+    _undo.append(entry);
+    _revision++;
+
+    // a new step invalidates redo
+    for (int i=0;i<_redo.size();++i) { removeFiles(_redo.at(i)); }
+    _redo.clear();
+
+    enforceLimit();
+    compressNext();
+}
+
+void History::apply(const History::Entry &entry,
+                    Common::Canvas *canvas,
+                    bool before)
+{
+    if (entry.hasCanvas) {
+        canvas->image = loadChunk(before?entry.canvasBefore:entry.canvasAfter);
+        canvas->profile = before?entry.profileBefore:entry.profileAfter;
+    }
+
+    QMapIterator<int, History::LayerDelta> layers(entry.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        const History::LayerDelta &delta = layers.value();
+        if (!(before?delta.hadLayer:delta.hasLayer)) {
+            canvas->layers.remove(layers.key());
+            continue;
+        }
+        Common::Layer layer = before?delta.before:delta.after;
+        layer.image = loadChunk(before?delta.beforePixels:delta.afterPixels);
+        Project::markDirty(&layer);
+        canvas->layers[layers.key()] = layer;
+    }
+
+    for (int i=0;i<entry.tiles.size();++i) {
+        const History::TileDelta &tile = entry.tiles.at(i);
+        if (!canvas->layers.contains(tile.layer)) { continue; }
+        Magick::Image pixels = loadChunk(before?tile.before:tile.after);
+        if (!pixels.isValid()) { continue; }
+        Project::markDirty(&canvas->layers[tile.layer],
+                           QRect(tile.pos,
+                                 QSize(static_cast<int>(pixels.columns()),
+                                       static_cast<int>(pixels.rows()))));
+        try {
+            canvas->layers[tile.layer].image.composite(pixels,
+                                                       tile.pos.x(),
+                                                       tile.pos.y(),
+                                                       Magick::CopyCompositeOp);
+        }
+        catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    }
+}
+
+void History::handleCompressed()
+{
+    History::Entry entry = _compressor->result();
+    bool spilling = _spilling;
+    _spilling = false;
+
+    // the entry may have been moved to redo or dropped in the meantime
+    bool found = false;
+    int failed = -1;
+    QList<History::Entry> *lists[2] = { &_undo, &_redo };
+    for (int list=0;list<2 && !found;++list) {
+        for (int i=0;i<lists[list]->size();++i) {
+            History::Entry &current = (*lists[list])[i];
+            if (current.id != entry.id) { continue; }
+            found = true;
+            current.pending = false;
+            if (spilling && !entry.spilled) {
+                if (list==0) { failed = i; }
+                break;
+            }
+            // never trade a step already on disk for a copy in memory
+            if (current.spilled && !entry.spilled) { break; }
+            entry.pending = false;
+            current = entry;
+            break;
+        }
+    }
+    if (!found) { removeFiles(entry); }
+
+    if (failed>=0) {
+        qWarning() << "failed to move history to disk, dropping step" << _undo.at(failed).label;
+        for (int i=0;i<=failed;++i) {
+            removeFiles(_undo.first());
+            _undo.removeFirst();
+        }
+    }
+    compressNext();
+}
+
+void History::compressNext()
+{
+    if (_compressor->isRunning()) { return; }
+
+    // over budget, move the oldest step to disk in the background
+    qint64 limit = static_cast<qint64>(_memoryLimit)*1024*1024;
+    qint64 total = 0;
+    for (int i=0;i<_undo.size();++i) { total += entryBytes(_undo.at(i)); }
+    for (int i=0;i<_redo.size();++i) { total += entryBytes(_redo.at(i)); }
+    if (total>limit) {
+        for (int i=0;i<_undo.size()-1;++i) {
+            if (_undo.at(i).spilled || _undo.at(i).pending) { continue; }
+            if (!QDir().mkpath(_spillPath)) { break; }
+            _undo[i].pending = true;
+            _spilling = true;
+            _compressor->setFuture(QtConcurrent::run(&History::spillEntry,
+                                                     _undo.at(i),
+                                                     QString("%1/%2")
+                                                     .arg(_spillPath)
+                                                     .arg(_undo.at(i).id)));
+            return;
+        }
+    }
+
+    // keep the latest step uncompressed for a fast undo
+    for (int i=0;i<_undo.size()-1;++i) {
+        if (_undo.at(i).compressed ||
+            _undo.at(i).spilled ||
+            _undo.at(i).pending) { continue; }
+        _undo[i].pending = true;
+        _compressor->setFuture(QtConcurrent::run(&History::compressEntry,
+                                                 _undo.at(i)));
+        return;
+    }
+}
+
+void History::enforceLimit()
+{
+    while (_undo.size()>HISTORY_MAX_STEPS) {
+        removeFiles(_undo.first());
+        _undo.removeFirst();
+    }
+}
+
+void History::removeFiles(const History::Entry &entry)
+{
+    if (!entry.spilled) { return; }
+    QFile::remove(entry.canvasBefore.file);
+    QFile::remove(entry.canvasAfter.file);
+    for (int i=0;i<entry.tiles.size();++i) {
+        QFile::remove(entry.tiles.at(i).before.file);
+        QFile::remove(entry.tiles.at(i).after.file);
+    }
+    QMapIterator<int, History::LayerDelta> layers(entry.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        QFile::remove(layers.value().beforePixels.file);
+        QFile::remove(layers.value().afterPixels.file);
+    }
+}
+
+History::Entry History::spillEntry(History::Entry entry,
+                                   const QString &prefix)
+{
+    // runs on the worker, a failed step comes back unspilled
+    QList<History::Chunk*> chunks;
+    chunks << &entry.canvasBefore << &entry.canvasAfter;
+    for (int i=0;i<entry.tiles.size();++i) {
+        chunks << &entry.tiles[i].before << &entry.tiles[i].after;
+    }
+    QMutableMapIterator<int, History::LayerDelta> layers(entry.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        chunks << &layers.value().beforePixels << &layers.value().afterPixels;
+    }
+
+    bool spilled = true;
+    for (int i=0;spilled && i<chunks.size();++i) {
+        spilled = spillChunk(chunks.at(i),
+                             QString("%1-%2").arg(prefix).arg(i));
+    }
+    if (!spilled) {
+        for (int i=0;i<chunks.size();++i) {
+            if (!chunks.at(i)->file.isEmpty()) { QFile::remove(chunks.at(i)->file); }
+        }
+        return entry;
+    }
+    entry.spilled = true;
+    entry.compressed = true;
+    return entry;
+}
+
+History::Entry History::compressEntry(History::Entry entry)
+{
+    compressChunk(&entry.canvasBefore);
+    compressChunk(&entry.canvasAfter);
+    for (int i=0;i<entry.tiles.size();++i) {
+        compressChunk(&entry.tiles[i].before);
+        compressChunk(&entry.tiles[i].after);
+    }
+    QMutableMapIterator<int, History::LayerDelta> layers(entry.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        compressChunk(&layers.value().beforePixels);
+        compressChunk(&layers.value().afterPixels);
+    }
+    entry.compressed = true;
+    return entry;
+}
+
+void History::compressChunk(History::Chunk *chunk)
+{
+    if (!chunk || !chunk->image.isValid()) { return; }
+    try {
+        Magick::Image image(chunk->image);
+        image.magick("MIFF");
+        image.compressType(Magick::ZipCompression);
+        image.write(&chunk->blob);
+        if (chunk->blob.length()>0) { chunk->image = Magick::Image(); }
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+}
+
+bool History::spillChunk(History::Chunk *chunk,
+                         const QString &filename)
+{
+    if (!chunk) { return false; }
+    if (!chunk->image.isValid() && chunk->blob.length()==0) { return true; }
+    compressChunk(chunk);
+    if (chunk->blob.length()==0) { return false; }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) { return false; }
+    qint64 length = static_cast<qint64>(chunk->blob.length());
+    bool written = file.write(static_cast<const char*>(chunk->blob.data()),
+                              length) == length;
+    file.close();
+    if (!written) {
+        file.remove();
+        return false;
+    }
+    chunk->file = filename;
+    chunk->blob = Magick::Blob();
+    return true;
+}
+
+Magick::Image History::loadChunk(const History::Chunk &chunk)
+{
+    if (chunk.image.isValid()) { return chunk.image; }
+
+    Magick::Blob blob = chunk.blob;
+    if (blob.length()==0 && !chunk.file.isEmpty()) {
+        QFile file(chunk.file);
+        if (file.open(QIODevice::ReadOnly)) {
+            QByteArray data = file.readAll();
+            blob = Magick::Blob(data.constData(),
+                                static_cast<size_t>(data.size()));
+            file.close();
+        }
+    }
+
+    Magick::Image image;
+    if (blob.length()==0) { return image; }
+    try { image.read(blob); }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return image;
+}
+
+qint64 History::chunkBytes(const History::Chunk &chunk)
+{
+    qint64 bytes = static_cast<qint64>(chunk.blob.length());
+    if (chunk.image.isValid()) {
+        bytes += static_cast<qint64>(chunk.image.columns()*
+                                     chunk.image.rows()*
+                                     chunk.image.channels()*
+                                     sizeof(Magick::Quantum));
+    }
+    return bytes;
+}
+
+qint64 History::entryBytes(const History::Entry &entry)
+{
+    qint64 bytes = chunkBytes(entry.canvasBefore)+chunkBytes(entry.canvasAfter);
+    for (int i=0;i<entry.tiles.size();++i) {
+        bytes += chunkBytes(entry.tiles.at(i).before);
+        bytes += chunkBytes(entry.tiles.at(i).after);
+    }
+    QMapIterator<int, History::LayerDelta> layers(entry.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        bytes += chunkBytes(layers.value().beforePixels);
+        bytes += chunkBytes(layers.value().afterPixels);
+    }
+    return bytes;
+}
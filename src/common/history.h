@@ -0,0 +1,169 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <QObject>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QRect>
+#include <QFutureWatcher>
+
+#include "common.h"
+
+#define HISTORY_TILE_SIZE 256
+#define HISTORY_MAX_STEPS 100
+#define HISTORY_MEMORY_LIMIT 1024
+
+class History : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    struct Chunk
+    {
+        Magick::Image image;
+        Magick::Blob blob;
+        QString file;
+    };
+
+    struct TileDelta
+    {
+        int layer = -1;
+        QPoint pos;
+        History::Chunk before;
+        History::Chunk after;
+    };
+
+    struct LayerDelta
+    {
+        bool hadLayer = false;
+        bool hasLayer = false;
+        Common::Layer before;
+        Common::Layer after;
+        History::Chunk beforePixels;
+        History::Chunk afterPixels;
+    };
+
+    struct Entry
+    {
+        int id = 0;
+        QString label;
+        QList<History::TileDelta> tiles;
+        QMap<int, History::LayerDelta> layers;
+        bool hasCanvas = false;
+        History::Chunk canvasBefore;
+        History::Chunk canvasAfter;
+        Magick::Blob profileBefore;
+        Magick::Blob profileAfter;
+        bool compressed = false;
+        bool spilled = false;
+        bool pending = false;
+    };
+
+    explicit History(QObject *parent = nullptr);
+    ~History();
+
+    static int getMemoryLimit();
+    static void setMemoryLimit(int mib);
+
+private:
+
+    QList<History::Entry> _undo;
+    QList<History::Entry> _redo;
+    History::Entry _pending;
+    QSet<quint64> _pendingTiles;
+    bool _recording;
+    int _lastID;
+    int _revision;
+    QString _spillPath;
+    QFutureWatcher<History::Entry> *_compressor;
+    bool _spilling;
+
+    static int _memoryLimit;
+
+public slots:
+
+    int getRevision();
+    void touch();
+    bool canUndo();
+    bool canRedo();
+    const QString undoLabel();
+    const QString redoLabel();
+
+    bool undo(Common::Canvas *canvas);
+    bool redo(Common::Canvas *canvas);
+    void clear();
+
+    void beginTiles(const QString &label);
+    void recordTiles(int layer,
+                     Magick::Image image,
+                     const QRect &rect);
+    void commitTiles(const Common::Canvas &canvas);
+
+    void recordAddLayer(int id,
+                        const Common::Layer &layer);
+    void recordRemoveLayer(int id,
+                           const Common::Layer &layer);
+    void recordCanvas(const QString &label,
+                      const Common::Canvas &before,
+                      const Common::Canvas &after);
+
+private slots:
+
+    void handleCompressed();
+    void compressNext();
+    void enforceLimit();
+
+private:
+
+    void push(History::Entry entry);
+    void apply(const History::Entry &entry,
+               Common::Canvas *canvas,
+               bool before);
+    static void removeFiles(const History::Entry &entry);
+
+    static History::Entry compressEntry(History::Entry entry);
+    static History::Entry spillEntry(History::Entry entry,
+                                     const QString &prefix);
+    static void compressChunk(History::Chunk *chunk);
+    static bool spillChunk(History::Chunk *chunk,
+                           const QString &filename);
+    static Magick::Image loadChunk(const History::Chunk &chunk);
+    static qint64 chunkBytes(const History::Chunk &chunk);
+    static qint64 entryBytes(const History::Entry &entry);
+};
+
+#endif // HISTORY_H
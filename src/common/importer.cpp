@@ -0,0 +1,651 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "importer.h"
+#include "project.h"
+#include "profileregistry.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QThread>
+#include <QtConcurrent/QtConcurrent>
+
+Importer::Importer(QObject *parent) : QObject(parent)
+  , _lastID(0)
+  , _progress(nullptr)
+{
+    qRegisterMetaType<Magick::Image>("Magick::Image");
+
+    // files are decoded concurrently, but only a few at a time
+    _pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+
+    _progress = new QTimer(this);
+    _progress->setInterval(IMPORTER_PROGRESS_INTERVAL);
+    connect(_progress, SIGNAL(timeout()),
+            this, SLOT(handleProgress()));
+}
+
+Importer::~Importer()
+{
+    // workers hold their own reference to the job, but call back
+    blockSignals(true);
+    cancelAll();
+    _pool.waitForDone();
+}
+
+int Importer::import(const QString &filename,
+                     Magick::Blob blob,
+                     const QString &target)
+{
+    if (filename.isEmpty() && blob.length()==0) { return -1; }
+    QSharedPointer<Importer::Job> job(new Importer::Job());
+    job->id = ++_lastID;
+    job->filename = filename;
+    job->target = target;
+    job->blob = blob;
+    _jobs.insert(job->id, job);
+    QtConcurrent::run(&_pool,
+                      &Importer::decode,
+                      this,
+                      job);
+    if (!_progress->isActive()) { _progress->start(); }
+    handleProgress();
+    return job->id;
+}
+
+void Importer::setProfile(int id,
+                          const QString &profile)
+{
+    if (!_jobs.contains(id)) { return; }
+    if (profile.isEmpty()) {
+        cancel(id);
+        return;
+    }
+    _jobs[id]->profile = profile;
+    _jobs[id]->hasProfile = true;
+    convertJob(id);
+}
+
+void Importer::cancel(int id)
+{
+    if (_streams.contains(id)) {
+        QSharedPointer<Importer::Job> job = _streams.take(id);
+        job->canceled.store(1);
+        job->bands.release(IMPORTER_BAND_QUEUE);
+        emit streamFinished(id, QImage());
+        handleProgress();
+        return;
+    }
+    if (!_jobs.contains(id)) { return; }
+    _jobs[id]->canceled.store(1);
+    finishJob(id);
+}
+
+void Importer::cancelAll()
+{
+    QList<int> ids = _jobs.keys()+_streams.keys();
+    for (int i=0;i<ids.size();++i) { cancel(ids.at(i)); }
+}
+
+bool Importer::isRunning()
+{
+    return _jobs.size()>0 || _streams.size()>0;
+}
+
+bool Importer::isStreaming(int id)
+{
+    return _streams.contains(id);
+}
+
+void Importer::decode(Importer *importer,
+                      QSharedPointer<Importer::Job> job)
+{
+    Magick::Image image;
+    QString error;
+
+    // projects can't be added as layers, skip them
+    if (!job->target.isEmpty() &&
+        !job->filename.isEmpty() &&
+        Common::isValidCanvas(job->filename))
+    {
+        QMetaObject::invokeMethod(importer,
+                                  "handleDecoded",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(int, job->id),
+                                  Q_ARG(Magick::Image, image),
+                                  Q_ARG(QString, error));
+        return;
+    }
+
+    try {
+        // ping first, the color profile can be chosen while decoding
+        Magick::Image info;
+        info.quiet(true);
+        if (job->blob.length()>0) { info.ping(job->blob); }
+        else { info.ping(job->filename.toStdString()); }
+
+        // huge images are streamed into an open canvas instead
+        if (job->target.isEmpty() &&
+            job->blob.length()==0 &&
+            isStreamable(info))
+        {
+            QMetaObject::invokeMethod(importer,
+                                      "handleStreamReady",
+                                      Qt::QueuedConnection,
+                                      Q_ARG(int, job->id),
+                                      Q_ARG(Magick::Image, info));
+            return;
+        }
+        QMetaObject::invokeMethod(importer,
+                                  "handlePinged",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(int, job->id),
+                                  Q_ARG(int, info.colorSpace()),
+                                  Q_ARG(bool, info.iccColorProfile().length()>0));
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+
+    try {
+        image.quiet(false);
+        MagickCore::SetImageInfoProgressMonitor(image.imageInfo(),
+                                                &Importer::monitor,
+                                                job.data());
+        if (job->blob.length()>0) { image.read(job->blob); }
+        else { image.read(job->filename.toStdString()); }
+    }
+    catch(Magick::Error &error_ ) { error = QString::fromStdString(error_.what()); }
+    catch(Magick::Warning &warn_ ) {
+        QMetaObject::invokeMethod(importer,
+                                  "handleWarning",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(QString, QString::fromStdString(warn_.what())));
+    }
+    if (job->canceled.load()) { return; }
+
+    // the image inherits the monitor, don't let it outlive the job
+    try {
+        MagickCore::SetImageInfoProgressMonitor(image.imageInfo(),
+                                                nullptr,
+                                                nullptr);
+        if (image.isValid()) {
+            MagickCore::SetImageProgressMonitor(image.image(),
+                                                nullptr,
+                                                nullptr);
+        }
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    QMetaObject::invokeMethod(importer,
+                              "handleDecoded",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, job->id),
+                              Q_ARG(Magick::Image, image),
+                              Q_ARG(QString, error));
+}
+
+void Importer::convert(Importer *importer,
+                       QSharedPointer<Importer::Job> job,
+                       Magick::Image image,
+                       const QString &profile)
+{
+    QString error;
+    try {
+        Magick::Blob blob = ProfileRegistry::blob(profile);
+        image = Common::convertColorspace(image,
+                                          Magick::Blob(),
+                                          blob);
+        if (image.iccColorProfile().length()==0) {
+            error = tr("Failed to assign color profile %1").arg(profile);
+        }
+    }
+    catch(Magick::Error &error_ ) { error = QString::fromStdString(error_.what()); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    if (job->canceled.load()) { return; }
+    QMetaObject::invokeMethod(importer,
+                              "handleConverted",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, job->id),
+                              Q_ARG(Magick::Image, image),
+                              Q_ARG(QString, error));
+}
+
+void Importer::stream(Importer *importer,
+                      QSharedPointer<Importer::Job> job)
+{
+    // rows are handed to streamRows() as they are decoded, only a
+    // band (and the overview) is kept here, never the whole image
+    QString error;
+    job->importer = importer;
+    Magick::Image reader;
+    try {
+        reader.quiet(true);
+        reader.fileName(job->filename.toStdString());
+        MagickCore::SetImageInfoProgressMonitor(reader.imageInfo(),
+                                                &Importer::monitor,
+                                                job.data());
+        MagickCore::ExceptionInfo *exception = MagickCore::AcquireExceptionInfo();
+        MagickCore::Image *image = MagickCore::ReadStream(reader.imageInfo(),
+                                                          &Importer::streamRows,
+                                                          exception);
+        if (image) { MagickCore::DestroyImageList(image); }
+        if (exception->severity >= MagickCore::ErrorException && !job->canceled.load()) {
+            error = QString::fromUtf8(exception->reason ? exception->reason : "");
+        }
+        MagickCore::DestroyExceptionInfo(exception);
+        MagickCore::SetImageInfoProgressMonitor(reader.imageInfo(),
+                                                nullptr,
+                                                nullptr);
+    }
+    catch(Magick::Error &error_ ) { error = QString::fromStdString(error_.what()); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    if (!job->canceled.load()) { flushBand(job.data()); }
+
+    QMetaObject::invokeMethod(importer,
+                              "handleStreamFinished",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, job->id),
+                              Q_ARG(QImage, toImage(job->overview)),
+                              Q_ARG(QString, error));
+}
+
+size_t Importer::streamRows(const MagickCore::Image *image,
+                            const void *pixels,
+                            const size_t columns)
+{
+    // the job rides along as client data of the progress monitor
+    Importer::Job *job = static_cast<Importer::Job*>(image->client_data);
+    if (!job || job->canceled.load() || !pixels) { return 0; }
+
+    if (job->map.isEmpty()) {
+        switch (image->colorspace) {
+        case MagickCore::CMYKColorspace:
+            job->map = QString("CMYK");
+            break;
+        case MagickCore::GRAYColorspace:
+            job->map = QString("I");
+            break;
+        default:
+            job->map = QString("RGB");
+        }
+        if (image->alpha_trait != MagickCore::UndefinedPixelTrait) { job->map.append("A"); }
+    }
+    size_t channels = image->number_channels;
+    size_t used = static_cast<size_t>(job->map.size());
+    if (used>channels || columns != image->columns) { return 0; }
+
+    // keep the channels we map, skip any extra channels
+    const MagickCore::Quantum *row = static_cast<const MagickCore::Quantum*>(pixels);
+    int offset = job->band.size();
+    job->band.resize(offset+static_cast<int>(columns*used));
+    MagickCore::Quantum *band = job->band.data()+offset;
+    for (size_t x=0;x<columns;++x) {
+        for (size_t c=0;c<used;++c) { band[x*used+c] = row[x*channels+c]; }
+    }
+    job->bandRows++;
+    if (job->bandRows>=IMPORTER_BAND_ROWS && !flushBand(job)) { return 0; }
+    return columns;
+}
+
+bool Importer::flushBand(Importer::Job *job)
+{
+    if (!job || job->bandRows==0) { return true; }
+    int width = static_cast<int>(job->info.columns());
+    QRect rect(0, job->bandY, width, job->bandRows);
+    Magick::Image pixels;
+    QImage preview;
+    try {
+        pixels = Magick::Image(static_cast<size_t>(width),
+                               static_cast<size_t>(job->bandRows),
+                               job->map.toStdString(),
+                               Magick::QuantumPixel,
+                               job->band.constData());
+        pixels.depth(job->info.depth());
+
+        // downscaled copy of the band, built up into the overview
+        double scale = qMin(1.0, static_cast<double>(CYAN_PROJECT_PREVIEW_SIZE)/
+                                 qMax(job->info.columns(), job->info.rows()));
+        if (!job->overview.isValid()) {
+            job->overview = Magick::Image(Magick::Geometry(qMax<size_t>(1, static_cast<size_t>(job->info.columns()*scale)),
+                                                           qMax<size_t>(1, static_cast<size_t>(job->info.rows()*scale))),
+                                          Magick::Color(0, 0, 0, 0));
+        }
+        Magick::Image reduced = pixels;
+        reduced.scale(Magick::Geometry(qMax<size_t>(1, static_cast<size_t>(width*scale)),
+                                       qMax<size_t>(1, static_cast<size_t>(job->bandRows*scale+0.5))));
+        job->overview.composite(reduced,
+                                0,
+                                static_cast<ssize_t>(job->bandY*scale),
+                                Magick::CopyCompositeOp);
+
+        // shown in the canvas until the band itself is rendered
+        preview = toImage(reduced);
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+
+    job->bandY += job->bandRows;
+    job->bandRows = 0;
+    job->band.clear();
+
+    // don't run ahead of the canvas, bands waiting there are memory too
+    job->bands.acquire();
+    if (job->canceled.load()) { return false; }
+    QMetaObject::invokeMethod(job->importer,
+                              "handleBand",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, job->id),
+                              Q_ARG(QRect, rect),
+                              Q_ARG(Magick::Image, pixels),
+                              Q_ARG(QImage, preview));
+    return true;
+}
+
+Magick::Image Importer::streamCanvas(Importer::Job *job)
+{
+    // blank canvas, the bands are copied into it as they are read
+    Magick::Image canvas = Project::blankImage(static_cast<int>(job->info.columns()),
+                                               static_cast<int>(job->info.rows()),
+                                               static_cast<int>(job->info.depth()),
+                                               job->info.colorSpace());
+    try {
+        canvas.magick("MIFF");
+        canvas.fileName(job->filename.toStdString());
+        canvas.label(QFileInfo(job->filename).baseName().toStdString());
+        Magick::Blob profile = job->info.iccColorProfile();
+        if (job->hasProfile) { profile = ProfileRegistry::blob(job->profile); }
+        if (profile.length()>0) { canvas.profile("ICC", profile); }
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return canvas;
+}
+
+bool Importer::isStreamable(Magick::Image info)
+{
+    if (info.columns()*info.rows() < IMPORTER_STREAM_PIXELS) { return false; }
+
+    // coders that deliver rows in order
+    QString format = QString::fromStdString(info.magick());
+    return format == "TIFF" ||
+           format == "TIF" ||
+           format == "PTIF" ||
+           format == "PNG" ||
+           format == "MIFF" ||
+           format == "PNM" ||
+           format == "PPM" ||
+           format == "PGM";
+}
+
+QImage Importer::toImage(Magick::Image image)
+{
+    QImage result;
+    if (!image.isValid()) { return result; }
+    try {
+        image.depth(8);
+        image.magick("PNG");
+        Magick::Blob blob;
+        image.write(&blob);
+        result = QImage::fromData(reinterpret_cast<const uchar*>(blob.data()),
+                                  static_cast<int>(blob.length()));
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return result;
+}
+
+MagickCore::MagickBooleanType Importer::monitor(const char *text,
+                                                const MagickCore::MagickOffsetType offset,
+                                                const MagickCore::MagickSizeType span,
+                                                void *data)
+{
+    Q_UNUSED(text)
+    Importer::Job *job = static_cast<Importer::Job*>(data);
+    if (!job) { return MagickCore::MagickTrue; }
+
+    // returning false makes the coder abort the read
+    if (job->canceled.load()) { return MagickCore::MagickFalse; }
+    if (span>0) { job->progress.store(static_cast<int>(offset*100/static_cast<MagickCore::MagickOffsetType>(span))); }
+    return MagickCore::MagickTrue;
+}
+
+void Importer::handlePinged(int id,
+                            int colorspace,
+                            bool hasProfile)
+{
+    // layers are converted to the canvas profile when added
+    if (!_jobs.contains(id) || hasProfile || !_jobs[id]->target.isEmpty()) { return; }
+    _jobs[id]->needsProfile = true;
+    emit needsProfile(id, colorspace);
+}
+
+void Importer::handleDecoded(int id,
+                             Magick::Image image,
+                             const QString &error)
+{
+    if (!_jobs.contains(id)) { return; }
+    QSharedPointer<Importer::Job> job = _jobs[id];
+    if (!error.isEmpty()) {
+        failJob(id, error);
+        return;
+    }
+    if (image.columns()==0 || image.rows()==0) {
+        if (job->target.isEmpty()) { failJob(id, tr("Not a readable image")); }
+        else { completeJob(id, Magick::Image()); } // skipped
+        return;
+    }
+
+    try {
+        image.magick("MIFF");
+        image.fileName(job->filename.toStdString());
+        if (image.label().empty()) {
+            QFileInfo fileInfo(job->filename);
+            image.label(fileInfo.baseName().toStdString());
+        }
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    job->image = image;
+    job->decoded = true;
+
+    // the ping may have missed a profile, or failed
+    if (image.iccColorProfile().length()==0 &&
+        !job->needsProfile &&
+        job->target.isEmpty())
+    {
+        job->needsProfile = true;
+        emit needsProfile(id, image.colorSpace());
+        return;
+    }
+    convertJob(id);
+}
+
+void Importer::handleConverted(int id,
+                               Magick::Image image,
+                               const QString &error)
+{
+    if (!_jobs.contains(id)) { return; }
+    if (!error.isEmpty()) { failJob(id, error); }
+    else { completeJob(id, image); }
+}
+
+void Importer::handleStreamReady(int id,
+                                 Magick::Image info)
+{
+    if (!_jobs.contains(id)) { return; }
+    QSharedPointer<Importer::Job> job = _jobs[id];
+    job->stream = true;
+    job->info = info;
+    job->decoded = true;
+    if (info.iccColorProfile().length()==0) {
+        job->needsProfile = true;
+        emit needsProfile(id, info.colorSpace());
+        return;
+    }
+    convertJob(id);
+}
+
+void Importer::handleBand(int id,
+                          const QRect &rect,
+                          Magick::Image pixels,
+                          const QImage &preview)
+{
+    if (!_streams.contains(id)) { return; }
+    emit previewReady(id, rect, preview);
+    emit bandReady(id, rect, pixels);
+    _streams[id]->bands.release();
+}
+
+void Importer::handleStreamFinished(int id,
+                                    const QImage &overview,
+                                    const QString &error)
+{
+    if (!_streams.contains(id)) { return; }
+    QSharedPointer<Importer::Job> job = _streams.take(id);
+    if (!error.isEmpty()) {
+        emit errorMessage(QString("%1: %2")
+                          .arg(QFileInfo(job->filename).fileName())
+                          .arg(error));
+    }
+    emit streamFinished(id, overview);
+    handleProgress();
+}
+
+void Importer::handleWarning(const QString &message)
+{
+    emit warningMessage(message);
+}
+
+void Importer::handleProgress()
+{
+    if (!isRunning()) {
+        _progress->stop();
+        emit progressChanged(100, 0);
+        return;
+    }
+    int total = 0;
+    QMapIterator<int, QSharedPointer<Importer::Job> > jobs(_jobs);
+    while (jobs.hasNext()) {
+        jobs.next();
+        if (jobs.value()->stream) { total += jobs.value()->progress.load(); }
+        else { total += jobs.value()->decoded || jobs.value()->done ? 100 : jobs.value()->progress.load(); }
+    }
+    QMapIterator<int, QSharedPointer<Importer::Job> > streams(_streams);
+    while (streams.hasNext()) {
+        streams.next();
+        total += streams.value()->progress.load();
+    }
+    int count = _jobs.size()+_streams.size();
+    emit progressChanged(total/count, count);
+}
+
+void Importer::convertJob(int id)
+{
+    if (!_jobs.contains(id)) { return; }
+    QSharedPointer<Importer::Job> job = _jobs[id];
+    if (!job->decoded || job->converting) { return; }
+    if (job->stream) {
+        if (job->needsProfile && !job->hasProfile) { return; }
+        completeJob(id, streamCanvas(job.data()));
+        return;
+    }
+    if (!job->needsProfile) {
+        completeJob(id, job->image);
+        return;
+    }
+    if (!job->hasProfile) { return; } // waiting for the user
+    job->converting = true;
+    QtConcurrent::run(&_pool,
+                      &Importer::convert,
+                      this,
+                      job,
+                      job->image,
+                      job->profile);
+    job->image = Magick::Image();
+}
+
+void Importer::completeJob(int id,
+                           Magick::Image image)
+{
+    if (!_jobs.contains(id)) { return; }
+    _jobs[id]->image = image;
+    _jobs[id]->done = true;
+    deliverJobs();
+}
+
+void Importer::failJob(int id,
+                       const QString &error)
+{
+    if (!_jobs.contains(id)) { return; }
+    QString filename = _jobs[id]->filename;
+    _errors << QString("%1: %2")
+               .arg(filename.isEmpty() ? tr("Image") : QFileInfo(filename).fileName())
+               .arg(error);
+    completeJob(id, Magick::Image());
+}
+
+void Importer::finishJob(int id)
+{
+    _jobs.remove(id);
+    deliverJobs();
+}
+
+void Importer::deliverJobs()
+{
+    // results are handed out in the order the files were opened
+    while (_jobs.size()>0 && _jobs.first()->done) {
+        QSharedPointer<Importer::Job> job = _jobs.take(_jobs.firstKey());
+
+        // registered first, the receiver of imported() asks isStreaming()
+        if (job->stream && job->image.isValid()) { _streams.insert(job->id, job); }
+        if (job->image.columns()>0 && job->image.rows()>0) {
+            emit imported(job->id, job->image, job->target);
+        }
+
+        // the canvas is open, start filling it
+        if (_streams.contains(job->id)) {
+            job->image = Magick::Image();
+            job->bands.release(IMPORTER_BAND_QUEUE);
+            QtConcurrent::run(&_pool,
+                              &Importer::stream,
+                              this,
+                              job);
+        }
+    }
+
+    // report all failed files at once
+    if (_jobs.size()==0 && _errors.size()>0) {
+        emit errorMessage(tr("Failed to open:\n%1").arg(_errors.join("\n")));
+        _errors.clear();
+    }
+    handleProgress();
+}
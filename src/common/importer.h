@@ -0,0 +1,182 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <QObject>
+#include <QMap>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <QVector>
+#include <QImage>
+
+#include "common.h"
+
+#define IMPORTER_PROGRESS_INTERVAL 100
+#define IMPORTER_STREAM_PIXELS 67108864
+#define IMPORTER_BAND_ROWS 256
+#define IMPORTER_BAND_QUEUE 4
+
+class Importer : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    struct Job
+    {
+        int id = 0;
+        QString filename;
+        QString target; // canvas to add the image to as a layer
+        Magick::Blob blob;
+        QAtomicInt canceled;
+        QAtomicInt progress;
+        bool decoded = false;
+        bool done = false;
+        bool converting = false;
+        bool needsProfile = false;
+        bool hasProfile = false;
+        QString profile;
+        Magick::Image image;
+
+        // streamed in bands straight into the canvas
+        bool stream = false;
+        Magick::Image info;
+        Importer *importer = nullptr;
+        QSemaphore bands;
+        QVector<MagickCore::Quantum> band;
+        int bandY = 0;
+        int bandRows = 0;
+        QString map;
+        Magick::Image overview;
+    };
+
+    explicit Importer(QObject *parent = nullptr);
+    ~Importer();
+
+signals:
+
+    void needsProfile(int id,
+                      int colorspace);
+    void imported(int id,
+                  Magick::Image image,
+                  const QString &target);
+    void previewReady(int id,
+                      const QRect &rect,
+                      const QImage &preview);
+    void bandReady(int id,
+                   const QRect &rect,
+                   Magick::Image pixels);
+    void streamFinished(int id,
+                        const QImage &overview);
+    void progressChanged(int percent,
+                         int jobs);
+    void errorMessage(const QString &message);
+    void warningMessage(const QString &message);
+
+private:
+
+    QMap<int, QSharedPointer<Importer::Job> > _jobs;
+    QMap<int, QSharedPointer<Importer::Job> > _streams;
+    int _lastID;
+    QTimer *_progress;
+    QThreadPool _pool;
+    QStringList _errors;
+
+    static void decode(Importer *importer,
+                       QSharedPointer<Importer::Job> job);
+    static void convert(Importer *importer,
+                        QSharedPointer<Importer::Job> job,
+                        Magick::Image image,
+                        const QString &profile);
+    static void stream(Importer *importer,
+                       QSharedPointer<Importer::Job> job);
+    static size_t streamRows(const MagickCore::Image *image,
+                             const void *pixels,
+                             const size_t columns);
+    static bool flushBand(Importer::Job *job);
+    static bool isStreamable(Magick::Image info);
+    static QImage toImage(Magick::Image image);
+    Magick::Image streamCanvas(Importer::Job *job);
+    static MagickCore::MagickBooleanType monitor(const char *text,
+                                                 const MagickCore::MagickOffsetType offset,
+                                                 const MagickCore::MagickSizeType span,
+                                                 void *data);
+
+public slots:
+
+    int import(const QString &filename,
+               Magick::Blob blob = Magick::Blob(),
+               const QString &target = QString());
+    void setProfile(int id,
+                    const QString &profile);
+    void cancel(int id);
+    void cancelAll();
+    bool isRunning();
+    bool isStreaming(int id);
+
+private slots:
+
+    void handlePinged(int id,
+                      int colorspace,
+                      bool hasProfile);
+    void handleDecoded(int id,
+                       Magick::Image image,
+                       const QString &error);
+    void handleConverted(int id,
+                         Magick::Image image,
+                         const QString &error);
+    void handleStreamReady(int id,
+                           Magick::Image info);
+    void handleBand(int id,
+                    const QRect &rect,
+                    Magick::Image pixels,
+                    const QImage &preview);
+    void handleStreamFinished(int id,
+                              const QImage &overview,
+                              const QString &error);
+    void handleWarning(const QString &message);
+    void handleProgress();
+    void convertJob(int id);
+    void completeJob(int id,
+                     Magick::Image image);
+    void failJob(int id,
+                 const QString &error);
+    void finishJob(int id);
+    void deliverJobs();
+};
+
+#endif // IMPORTER_H
@@ -34,6 +34,8 @@
 
 #include <QMimeData>
 
+#include "sniffer.h"
+
 Mdi::Mdi(QWidget *parent)
     : QMdiArea(parent)
 {
@@ -42,6 +44,12 @@ Mdi::Mdi(QWidget *parent)
 
 void Mdi::dragEnterEvent(QDragEnterEvent *event)
 {
+    // classified once per file, drag-overs are served from the cache
+    if (!event->mimeData()->hasUrls() ||
+        !Sniffer::hasMedia(event->mimeData()->urls())) {
+        event->ignore();
+        return;
+    }
     event->acceptProposedAction();
 }
 
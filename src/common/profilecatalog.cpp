@@ -0,0 +1,281 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "profilecatalog.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QDebug>
+
+QMutex ProfileCatalog::_mutex;
+bool ProfileCatalog::_loaded = false;
+QElapsedTimer ProfileCatalog::_checked;
+QMap<QString, ProfileCatalog::Folder> ProfileCatalog::_folders;
+QMap<QString, ProfileCatalog::Entry> ProfileCatalog::_entries;
+QStringList ProfileCatalog::_order;
+
+QList<ProfileCatalog::Entry> ProfileCatalog::profiles()
+{
+    refresh();
+    QMutexLocker lock(&_mutex);
+    QList<ProfileCatalog::Entry> result;
+    for (int i=0;i<_order.size();++i) {
+        const ProfileCatalog::Entry &entry = _entries[_order.at(i)];
+        if (entry.description.isEmpty()) { continue; } // not a usable profile
+        result << entry;
+    }
+    return result;
+}
+
+QList<ProfileCatalog::Entry> ProfileCatalog::profiles(Magick::ColorspaceType colorspace)
+{
+    QList<ProfileCatalog::Entry> result;
+    QList<ProfileCatalog::Entry> entries = profiles();
+    for (int i=0;i<entries.size();++i) {
+        if (entries.at(i).colorspace != colorspace) { continue; }
+        result << entries.at(i);
+    }
+    return result;
+}
+
+void ProfileCatalog::refresh(bool force)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_loaded) {
+        load();
+        _loaded = true;
+    }
+
+    // asked for several times in a row at startup, once is enough
+    if (!force &&
+        _checked.isValid() &&
+        _checked.elapsed()<PROFILE_CATALOG_INTERVAL) { return; }
+
+    // unchanged folders are not listed again
+    bool changed = false;
+    QMap<QString, ProfileCatalog::Folder> folders;
+    QStringList files;
+    QStringList roots = Common::getColorProfilesPath();
+    for (int i=0;i<roots.size();++i) {
+        scanFolder(QDir::cleanPath(roots.at(i)), &folders, &files, &changed);
+    }
+    if (folders.size() != _folders.size()) { changed = true; }
+    _folders = folders;
+
+    // only new or modified profiles are opened
+    QMap<QString, ProfileCatalog::Entry> entries;
+    QStringList order;
+    for (int i=0;i<files.size();++i) {
+        const QString &filename = files.at(i);
+        if (entries.contains(filename)) { continue; }
+        QFileInfo info(filename);
+        qint64 size = info.size();
+        qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        ProfileCatalog::Entry entry = _entries.value(filename);
+        if (!_entries.contains(filename) ||
+            entry.size != size ||
+            entry.modified != modified)
+        {
+            readEntry(filename, size, modified, &entry);
+            changed = true;
+        }
+        entries[filename] = entry;
+        order << filename;
+    }
+    if (entries.size() != _entries.size()) { changed = true; }
+    _entries = entries;
+    _order = order;
+    _checked.start();
+
+    if (changed) { save(); }
+}
+
+const QString ProfileCatalog::catalogPath()
+{
+    return QString("%1/profiles.catalog")
+           .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+}
+
+void ProfileCatalog::scanFolder(const QString &path,
+                                QMap<QString, ProfileCatalog::Folder> *folders,
+                                QStringList *files,
+                                bool *changed)
+{
+    if (!folders || !files || !changed || folders->contains(path)) { return; }
+    QFileInfo info(path);
+    if (!info.isDir()) { return; }
+
+    // adding or removing entries changes the folder mtime
+    qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    ProfileCatalog::Folder folder = _folders.value(path);
+    if (!_folders.contains(path) || folder.modified != modified) {
+        QDir dir(path);
+        folder.modified = modified;
+        folder.folders.clear();
+        folder.files.clear();
+        QStringList subs = dir.entryList(QDir::Dirs|QDir::NoDotAndDotDot|QDir::NoSymLinks);
+        for (int i=0;i<subs.size();++i) { folder.folders << dir.absoluteFilePath(subs.at(i)); }
+        QStringList filter;
+        filter << "*.icc" << "*.icm";
+        QStringList icc = dir.entryList(filter, QDir::Files);
+        for (int i=0;i<icc.size();++i) { folder.files << dir.absoluteFilePath(icc.at(i)); }
+        *changed = true;
+    }
+    folders->insert(path, folder);
+    *files << folder.files;
+    for (int i=0;i<folder.folders.size();++i) {
+        scanFolder(folder.folders.at(i), folders, files, changed);
+    }
+}
+
+void ProfileCatalog::readEntry(const QString &filename,
+                               qint64 size,
+                               qint64 modified,
+                               ProfileCatalog::Entry *entry)
+{
+    if (!entry) { return; }
+
+    // broken profiles are kept too, so they are not opened again
+    *entry = ProfileCatalog::Entry();
+    entry->filename = filename;
+    entry->size = size;
+    entry->modified = modified;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) { return; }
+    QByteArray data = file.readAll();
+    entry->hash = QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+
+    cmsHPROFILE profile = cmsOpenProfileFromMem(data.constData(),
+                                                static_cast<cmsUInt32Number>(data.size()));
+    if (!profile) { return; }
+    entry->profileClass = cmsGetDeviceClass(profile);
+    entry->version = cmsGetEncodedICCversion(profile);
+    switch (cmsGetColorSpace(profile)) {
+    case cmsSigRgbData:
+        entry->colorspace = Magick::sRGBColorspace;
+        break;
+    case cmsSigCmykData:
+        entry->colorspace = Magick::CMYKColorspace;
+        break;
+    case cmsSigGrayData:
+        entry->colorspace = Magick::GRAYColorspace;
+        break;
+    default:;
+    }
+    entry->description = Common::getProfileTag(profile); // closes the profile
+}
+
+void ProfileCatalog::load()
+{
+    QFile file(catalogPath());
+    if (!file.open(QIODevice::ReadOnly)) { return; }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    QByteArray magic(8, '\0');
+    quint32 version = 0;
+    if (stream.readRawData(magic.data(), magic.size()) != magic.size() ||
+        magic != QByteArray(PROFILE_CATALOG_MAGIC)) { return; }
+    stream >> version;
+    if (version != PROFILE_CATALOG_VERSION) { return; }
+
+    QMap<QString, ProfileCatalog::Folder> folders;
+    QMap<QString, ProfileCatalog::Entry> entries;
+    QStringList order;
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i=0;i<count && stream.status() == QDataStream::Ok;++i) {
+        QString path;
+        ProfileCatalog::Folder folder;
+        stream >> path >> folder.modified >> folder.folders >> folder.files;
+        folders[path] = folder;
+    }
+    stream >> count;
+    for (quint32 i=0;i<count && stream.status() == QDataStream::Ok;++i) {
+        ProfileCatalog::Entry entry;
+        qint32 colorspace = 0;
+        stream >> entry.filename >> entry.description >> colorspace;
+        stream >> entry.profileClass >> entry.version >> entry.hash;
+        stream >> entry.size >> entry.modified;
+        entry.colorspace = colorspace;
+        entries[entry.filename] = entry;
+        order << entry.filename;
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "ignoring broken profile catalog" << file.fileName();
+        return;
+    }
+    _folders = folders;
+    _entries = entries;
+    _order = order;
+}
+
+void ProfileCatalog::save()
+{
+    QDir().mkpath(QFileInfo(catalogPath()).absolutePath());
+    QSaveFile file(catalogPath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << file.errorString();
+        return;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream.writeRawData(PROFILE_CATALOG_MAGIC, 8);
+    stream << quint32(PROFILE_CATALOG_VERSION);
+
+    stream << quint32(_folders.size());
+    QMapIterator<QString, ProfileCatalog::Folder> i(_folders);
+    while (i.hasNext()) {
+        i.next();
+        stream << i.key() << i.value().modified << i.value().folders << i.value().files;
+    }
+    stream << quint32(_order.size());
+    for (int y=0;y<_order.size();++y) {
+        const ProfileCatalog::Entry &entry = _entries[_order.at(y)];
+        stream << entry.filename << entry.description << qint32(entry.colorspace);
+        stream << entry.profileClass << entry.version << entry.hash;
+        stream << entry.size << entry.modified;
+    }
+    if (stream.status() != QDataStream::Ok) {
+        file.cancelWriting();
+        return;
+    }
+    file.commit();
+}
@@ -0,0 +1,99 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef PROFILECATALOG_H
+#define PROFILECATALOG_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include "common.h"
+
+#define PROFILE_CATALOG_MAGIC "CYANICCS"
+#define PROFILE_CATALOG_VERSION 1
+#define PROFILE_CATALOG_INTERVAL 2000
+
+class ProfileCatalog
+{
+public:
+
+    struct Entry
+    {
+        QString filename;
+        QString description;
+        int colorspace = Magick::UndefinedColorspace;
+        quint32 profileClass = 0;
+        quint32 version = 0;
+        QByteArray hash;
+        qint64 size = 0;
+        qint64 modified = 0;
+    };
+
+    static QList<ProfileCatalog::Entry> profiles();
+    static QList<ProfileCatalog::Entry> profiles(Magick::ColorspaceType colorspace);
+    static void refresh(bool force = false);
+    static const QString catalogPath();
+
+private:
+
+    struct Folder
+    {
+        qint64 modified = 0;
+        QStringList folders;
+        QStringList files;
+    };
+
+    static void scanFolder(const QString &path,
+                           QMap<QString, ProfileCatalog::Folder> *folders,
+                           QStringList *files,
+                           bool *changed);
+    static void readEntry(const QString &filename,
+                          qint64 size,
+                          qint64 modified,
+                          ProfileCatalog::Entry *entry);
+    static void load();
+    static void save();
+
+    static QMutex _mutex;
+    static bool _loaded;
+    static QElapsedTimer _checked;
+    static QMap<QString, ProfileCatalog::Folder> _folders;
+    static QMap<QString, ProfileCatalog::Entry> _entries;
+    static QStringList _order;
+};
+
+#endif // PROFILECATALOG_H
@@ -0,0 +1,145 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "profileregistry.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+#include <QDebug>
+
+QMutex ProfileRegistry::_mutex;
+QMap<QByteArray, ProfileRegistry::Handle> ProfileRegistry::_profiles;
+QMap<const void*, QByteArray> ProfileRegistry::_data;
+QMap<QString, ProfileRegistry::File> ProfileRegistry::_files;
+
+ProfileRegistry::Profile::~Profile()
+{
+    if (handle) { cmsCloseProfile(handle); }
+}
+
+ProfileRegistry::Handle ProfileRegistry::fromFile(const QString &filename)
+{
+    if (filename.isEmpty()) { return ProfileRegistry::Handle(); }
+    QFileInfo info(filename);
+    if (!info.isFile()) { return ProfileRegistry::Handle(); }
+    QString key = info.absoluteFilePath();
+    qint64 size = info.size();
+    qint64 modified = info.lastModified().toMSecsSinceEpoch();
+
+    {
+        QMutexLocker lock(&_mutex);
+        if (_files.contains(key)) {
+            const ProfileRegistry::File &file = _files[key];
+            if (file.size == size &&
+                file.modified == modified &&
+                _profiles.contains(file.hash)) { return _profiles.value(file.hash); }
+        }
+    }
+
+    // ICC files are used as is, no need to decode them through Magick
+    QFile file(key);
+    if (!file.open(QIODevice::ReadOnly)) { return ProfileRegistry::Handle(); }
+    QByteArray data = file.readAll();
+    if (data.isEmpty()) { return ProfileRegistry::Handle(); }
+    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+
+    QMutexLocker lock(&_mutex);
+    ProfileRegistry::Handle profile = insert(hash,
+                                             Magick::Blob(data.constData(),
+                                                          static_cast<size_t>(data.size())));
+    if (profile) {
+        ProfileRegistry::File entry = {size, modified, hash};
+        _files[key] = entry;
+    }
+    return profile;
+}
+
+ProfileRegistry::Handle ProfileRegistry::fromBlob(const Magick::Blob &blob)
+{
+    if (blob.length()==0) { return ProfileRegistry::Handle(); }
+    QByteArray key = hash(blob);
+    QMutexLocker lock(&_mutex);
+    return insert(key, blob);
+}
+
+Magick::Blob ProfileRegistry::blob(const QString &filename)
+{
+    ProfileRegistry::Handle profile = fromFile(filename);
+    if (!profile) {
+        qWarning() << "unable to read color profile" << filename;
+        return Magick::Blob();
+    }
+    return profile->blob;
+}
+
+Magick::Blob ProfileRegistry::intern(const Magick::Blob &blob)
+{
+    // copies of the returned blob share the registry's data
+    ProfileRegistry::Handle profile = fromBlob(blob);
+    if (!profile) { return blob; }
+    return profile->blob;
+}
+
+const QByteArray ProfileRegistry::hash(const Magick::Blob &blob)
+{
+    // blobs handed out by the registry are recognized without hashing
+    {
+        QMutexLocker lock(&_mutex);
+        QMap<const void*, QByteArray>::const_iterator it = _data.constFind(blob.data());
+        if (it != _data.constEnd() &&
+            _profiles.value(it.value())->blob.length() == blob.length()) { return it.value(); }
+    }
+    return QCryptographicHash::hash(QByteArray::fromRawData(static_cast<const char*>(blob.data()),
+                                                            static_cast<int>(blob.length())),
+                                    QCryptographicHash::Md5).toHex();
+}
+
+ProfileRegistry::Handle ProfileRegistry::insert(const QByteArray &hash,
+                                                const Magick::Blob &blob)
+{
+    if (_profiles.contains(hash)) { return _profiles.value(hash); }
+
+    cmsHPROFILE handle = cmsOpenProfileFromMem(blob.data(),
+                                               static_cast<cmsUInt32Number>(blob.length()));
+    if (!handle) { return ProfileRegistry::Handle(); }
+
+    QSharedPointer<ProfileRegistry::Profile> profile(new ProfileRegistry::Profile);
+    profile->hash = hash;
+    profile->blob = blob;
+    profile->handle = handle;
+    _profiles[hash] = profile;
+    _data[profile->blob.data()] = hash;
+    return profile;
+}
@@ -0,0 +1,954 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "project.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QThread>
+#include <QStandardPaths>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QtConcurrent/QtConcurrent>
+
+bool Project::isProject(const QString &filename)
+{
+    return probe(filename);
+}
+
+bool Project::probe(const QString &filename,
+                    Project::Summary *summary)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) { return false; }
+    Project::Header header;
+    if (!readHeader(&file, &header)) { return false; }
+    if (!summary) { return true; }
+    summary->version = header.version;
+
+    // the summary is read together with the header, a single small read
+    if (header.version>1) {
+        QByteArray data = file.read(CYAN_PROJECT_SUMMARY_SIZE);
+        QDataStream stream(data);
+        stream.setVersion(QDataStream::Qt_5_6);
+        if (readSummary(stream, summary, false) &&
+            summary->layers.size() == summary->layerCount) { return true; }
+    }
+
+    // older projects, or too many layers for the summary, use the index
+    if (!file.seek(static_cast<qint64>(header.indexOffset))) { return false; }
+    QByteArray index = file.read(static_cast<qint64>(header.indexSize));
+    QDataStream stream(index);
+    stream.setVersion(QDataStream::Qt_5_6);
+    return readSummary(stream, summary, true);
+}
+
+bool Project::write(Common::Canvas *canvas,
+                    const QString &filename,
+                    Project::Codec codec,
+                    bool compact,
+                    QThreadPool *pool,
+                    const Project::Tiles *tiles)
+{
+    if (!canvas || filename.isEmpty() || !canvas->image.isValid()) { return false; }
+    if (!pool) { pool = QThreadPool::globalInstance(); }
+    bool background = pool != QThreadPool::globalInstance();
+
+    // unchanged tiles are reused from the current project file
+    QFile source(canvas->filename);
+    bool hasSource = !canvas->filename.isEmpty() && source.open(QIODevice::ReadOnly);
+
+    // saving over the project we came from only appends changed tiles
+    // and a new index, everything else is written to a temporary file
+    // that replaces the target on commit
+    Project::Summary current;
+    bool append = !compact &&
+                  hasSource &&
+                  QFileInfo(filename) == QFileInfo(canvas->filename) &&
+                  probe(filename, &current) &&
+                  current.version == CYAN_PROJECT_FORMAT;
+    QSaveFile saveFile(filename);
+    QFile appendFile(filename);
+    QFileDevice *file = append ? static_cast<QFileDevice*>(&appendFile) : &saveFile;
+    if (!file->open(append ? QIODevice::ReadWrite : QIODevice::WriteOnly)) {
+        qWarning() << "failed to open" << filename << file->errorString();
+        return false;
+    }
+    qint64 appendFrom = append ? file->size() : 0;
+    if (append) { file->seek(appendFrom); }
+    else { file->write(QByteArray(CYAN_PROJECT_HEADER_SIZE+CYAN_PROJECT_SUMMARY_SIZE, '\0')); }
+
+    // tiles of all layers are encoded in parallel
+    QList<Project::EncodeJob> jobs;
+    QList<int> jobLayers;
+    QMapIterator<int, Common::Layer> layers(canvas->layers);
+    while (layers.hasNext()) {
+        layers.next();
+        const Common::Layer &layer = layers.value();
+        int width = static_cast<int>(layer.image.columns());
+        int height = static_cast<int>(layer.image.rows());
+        QList<Common::Chunk> stored = layer.chunks+layer.saved;
+        for (int y=0;y<height;y+=CYAN_PROJECT_TILE_SIZE) {
+            for (int x=0;x<width;x+=CYAN_PROJECT_TILE_SIZE) {
+                Project::EncodeJob job;
+                job.image = layer.image;
+                job.rect = QRect(x,
+                                 y,
+                                 qMin(CYAN_PROJECT_TILE_SIZE, width-x),
+                                 qMin(CYAN_PROJECT_TILE_SIZE, height-y));
+                job.codec = codec;
+                job.background = background;
+                for (int i=0;hasSource && i<stored.size();++i) {
+                    if (stored.at(i).rect == job.rect) {
+                        job.stored = true;
+                        job.chunk = stored.at(i);
+                        break;
+                    }
+                }
+                if (!job.stored && tiles) {
+                    job.image = tiles->value(layers.key()).value(qMakePair(x, y));
+                    job.cropped = true;
+                }
+                jobs.append(job);
+                jobLayers.append(layers.key());
+            }
+        }
+    }
+
+    // encode ahead of the writer, but never more than one chunk per
+    // worker, so memory use doesn't grow with the size of the canvas
+    QList<QFuture<QByteArray> > encoded;
+    int inFlight = qMax(1, pool->maxThreadCount());
+    int queued = 0;
+
+    // write the chunks in order as they become available
+    QMap<int, QList<Common::Chunk> > written;
+    bool failed = false;
+    for (int i=0;i<jobs.size() && !failed;++i) {
+        for (;queued<jobs.size() && queued-i<inFlight;++queued) {
+            encoded.append(QtConcurrent::run(pool,
+                                             &Project::encodeJob,
+                                             jobs.at(queued)));
+        }
+        QByteArray result = encoded.takeFirst().result();
+        const Project::EncodeJob &job = jobs.at(i);
+        if (job.stored && append) { // already in the file
+            written[jobLayers.at(i)].append(job.chunk);
+            continue;
+        }
+        QByteArray data;
+        if (job.stored) {
+            if (source.seek(job.chunk.offset)) { data = source.read(job.chunk.size); }
+        } else { data = result; }
+        if (data.isEmpty()) {
+            qWarning() << "failed to encode tile" << job.rect;
+            failed = true;
+            break;
+        }
+
+        Common::Chunk chunk;
+        chunk.rect = job.rect;
+        chunk.offset = file->pos();
+        chunk.size = data.size();
+        if (file->write(data) != data.size()) {
+            qWarning() << "failed to write" << filename << file->errorString();
+            failed = true;
+            break;
+        }
+        written[jobLayers.at(i)].append(chunk);
+    }
+    for (int i=0;i<encoded.size();++i) { encoded[i].waitForFinished(); }
+
+    // write index
+    Project::Header header;
+    header.version = CYAN_PROJECT_FORMAT;
+    header.indexOffset = static_cast<quint64>(file->pos());
+
+    QByteArray index;
+    QDataStream stream(&index, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << canvas->label;
+    stream << static_cast<qint32>(canvas->image.columns());
+    stream << static_cast<qint32>(canvas->image.rows());
+    stream << static_cast<qint32>(canvas->image.depth());
+    stream << static_cast<qint32>(canvas->image.colorSpace());
+    stream << QByteArray(static_cast<const char*>(canvas->profile.data()),
+                         static_cast<int>(canvas->profile.length()));
+    stream << static_cast<qint32>(canvas->layers.size());
+    layers.toFront();
+    while (layers.hasNext()) {
+        layers.next();
+        const Common::Layer &layer = layers.value();
+        stream << static_cast<qint32>(layers.key());
+        stream << layer.label;
+        stream << static_cast<qint32>(layer.image.columns());
+        stream << static_cast<qint32>(layer.image.rows());
+        stream << layer.pos;
+        stream << layer.visible;
+        stream << layer.opacity;
+        stream << static_cast<qint32>(layer.composite);
+        const QList<Common::Chunk> &chunks = written[layers.key()];
+        stream << static_cast<qint32>(chunks.size());
+        for (int i=0;i<chunks.size();++i) {
+            stream << chunks.at(i).rect;
+            stream << chunks.at(i).offset;
+            stream << chunks.at(i).size;
+        }
+    }
+
+    // previews follow the layers, thumbnails of layers not fully
+    // loaded (or unchanged) are kept from the current project,
+    // a snapshot has no layer pixels to render new ones from
+    QMap<int, QImage> thumbs;
+    bool changed = !tiles && canvas->preview.isNull();
+    layers.toFront();
+    while (layers.hasNext()) {
+        layers.next();
+        QImage thumb = layers.value().thumbnail;
+        if (thumb.isNull() && !tiles) {
+            thumb = thumbnail(layers.value().image,
+                              CYAN_PROJECT_THUMB_SIZE);
+            changed = true;
+        }
+        thumbs.insert(layers.key(), thumb);
+    }
+    QImage preview = changed ? renderPreview(*canvas) : canvas->preview;
+    stream << preview;
+    stream << static_cast<qint32>(thumbs.size());
+    QMapIterator<int, QImage> thumb(thumbs);
+    while (thumb.hasNext()) {
+        thumb.next();
+        stream << static_cast<qint32>(thumb.key()) << thumb.value();
+    }
+    header.indexSize = static_cast<quint64>(index.size());
+
+    // the header is written last, it switches to the new index
+    failed = failed ||
+             file->write(index) != index.size() ||
+             !file->flush() ||
+             !file->seek(0) ||
+             !writeHeader(file, header) ||
+             !writeSummary(file, *canvas);
+    if (append) {
+        failed = failed || !file->flush();
+        if (failed) { appendFile.resize(appendFrom); }
+        appendFile.close();
+    } else {
+        failed = failed || !saveFile.commit();
+        if (failed) { saveFile.cancelWriting(); }
+    }
+    if (failed) {
+        qWarning() << "failed to write" << filename << file->errorString();
+        return false;
+    }
+
+    // all tiles are now stored in the new file
+    QMutableMapIterator<int, Common::Layer> stored(canvas->layers);
+    while (stored.hasNext()) {
+        stored.next();
+        QList<Common::Chunk> &chunks = stored.value().chunks;
+        const QList<Common::Chunk> &moved = written[stored.key()];
+        for (int i=0;i<chunks.size();++i) {
+            for (int y=0;y<moved.size();++y) {
+                if (moved.at(y).rect != chunks.at(i).rect) { continue; }
+                chunks[i] = moved.at(y);
+                break;
+            }
+        }
+        stored.value().saved = moved;
+        stored.value().thumbnail = thumbs.value(stored.key());
+    }
+    canvas->preview = preview;
+    canvas->filename = filename;
+    return true;
+}
+
+bool Project::needsCompaction(const Common::Canvas &canvas)
+{
+    QFileInfo info(canvas.filename);
+    if (canvas.filename.isEmpty() || !info.exists()) { return false; }
+
+    // bytes still referenced by the index
+    qint64 used = CYAN_PROJECT_HEADER_SIZE+CYAN_PROJECT_SUMMARY_SIZE;
+    QMapIterator<int, Common::Layer> layers(canvas.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        for (int i=0;i<layers.value().saved.size();++i) {
+            used += layers.value().saved.at(i).size;
+        }
+    }
+    return info.size()-used > CYAN_PROJECT_COMPACT_MIN &&
+           info.size() > used*CYAN_PROJECT_COMPACT_RATIO;
+}
+
+Common::Canvas Project::compact(Common::Canvas canvas)
+{
+    // written next to the project, commitCompaction() swaps it in once
+    // nothing has the project file open anymore
+    QString filename = canvas.filename;
+    if (!write(&canvas,
+               QString("%1.compact").arg(filename),
+               Project::BalancedCodec,
+               true))
+    {
+        canvas.error = QObject::tr("Failed to compact project %1")
+                       .arg(filename);
+    }
+    canvas.filename = filename;
+    return canvas;
+}
+
+bool Project::commitCompaction(const QString &filename)
+{
+    // the old project is kept until the compacted one is in place
+    QString compacted = QString("%1.compact").arg(filename);
+    QString backup = QString("%1.bak").arg(filename);
+    if (!QFile::exists(compacted)) { return false; }
+    QFile::remove(backup);
+    if (!QFile::rename(filename, backup)) {
+        QFile::remove(compacted);
+        return false;
+    }
+    if (!QFile::rename(compacted, filename)) {
+        QFile::rename(backup, filename);
+        QFile::remove(compacted);
+        return false;
+    }
+    QFile::remove(backup);
+    return true;
+}
+
+const QString Project::codecName(Project::Codec codec)
+{
+    switch (codec) {
+    case Project::FastCodec:
+        return QObject::tr("Fast");
+    case Project::ArchiveCodec:
+        return QObject::tr("Archive");
+    default:;
+    }
+    return QObject::tr("Balanced");
+}
+
+Magick::CompressionType Project::codecCompression(Project::Codec codec)
+{
+    return codec == Project::ArchiveCodec ? Magick::LZMACompression : Magick::ZipCompression;
+}
+
+QList<Project::CodecResult> Project::benchmark(Common::Canvas canvas)
+{
+    // a sample of tiles spread over all layers
+    QList<Project::EncodeJob> tiles;
+    QMapIterator<int, Common::Layer> layers(canvas.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        const Common::Layer &layer = layers.value();
+        int width = static_cast<int>(layer.image.columns());
+        int height = static_cast<int>(layer.image.rows());
+        for (int y=0;y<height;y+=CYAN_PROJECT_TILE_SIZE) {
+            for (int x=0;x<width;x+=CYAN_PROJECT_TILE_SIZE) {
+                Project::EncodeJob job;
+                job.image = layer.image;
+                job.rect = QRect(x,
+                                 y,
+                                 qMin(CYAN_PROJECT_TILE_SIZE, width-x),
+                                 qMin(CYAN_PROJECT_TILE_SIZE, height-y));
+                tiles.append(job);
+            }
+        }
+    }
+    QList<Project::EncodeJob> jobs;
+    int step = qMax(1, tiles.size()/CYAN_PROJECT_BENCHMARK_TILES);
+    for (int i=0;i<tiles.size();i+=step) { jobs.append(tiles.at(i)); }
+
+    QList<Project::CodecResult> results;
+    QList<Project::Codec> codecs;
+    codecs << Project::FastCodec << Project::BalancedCodec << Project::ArchiveCodec;
+    for (int c=0;c<codecs.size();++c) {
+        Project::CodecResult result;
+        result.codec = codecs.at(c);
+        for (int i=0;i<jobs.size();++i) {
+            jobs[i].codec = result.codec;
+            result.rawBytes += static_cast<qint64>(jobs.at(i).rect.width())*jobs.at(i).rect.height()*
+                               static_cast<qint64>(jobs.at(i).image.channels()*jobs.at(i).image.depth()/8);
+        }
+        QElapsedTimer timer;
+        timer.start();
+        QList<QByteArray> encoded = QtConcurrent::blockingMapped<QList<QByteArray> >(jobs,
+                                                                                    &Project::encodeJob);
+        result.msecs = timer.elapsed();
+        for (int i=0;i<encoded.size();++i) { result.bytes += encoded.at(i).size(); }
+        results.append(result);
+    }
+    return results;
+}
+
+const QString Project::autosavePath()
+{
+    QString path = QString("%1/autosave")
+                   .arg(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+    QDir().mkpath(path);
+    return path;
+}
+
+const QString Project::autosavePath(qint64 pid)
+{
+    // each running instance has its own folder
+    QString path = QString("%1/%2").arg(autosavePath()).arg(pid);
+    QDir().mkpath(path);
+    return path;
+}
+
+const QString Project::autosaveLockFile(qint64 pid)
+{
+    // held by the instance while it runs, recovery skips locked folders
+    return QString("%1/%2.lock").arg(autosavePath()).arg(pid);
+}
+
+Common::Canvas Project::snapshot(const Common::Canvas &canvas,
+                                Project::Tiles *tiles)
+{
+    // only tiles that can't be copied from the project file are cropped,
+    // the layer images are not shared, so painting never copies a layer
+    Common::Canvas result = canvas;
+    if (!tiles) { return result; }
+    bool hasSource = !canvas.filename.isEmpty() && QFileInfo(canvas.filename).exists();
+    QMutableMapIterator<int, Common::Layer> layers(result.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        Common::Layer &layer = layers.value();
+        int width = static_cast<int>(layer.image.columns());
+        int height = static_cast<int>(layer.image.rows());
+        QList<Common::Chunk> stored = layer.chunks+layer.saved;
+        for (int y=0;y<height;y+=CYAN_PROJECT_TILE_SIZE) {
+            for (int x=0;x<width;x+=CYAN_PROJECT_TILE_SIZE) {
+                QRect rect(x,
+                           y,
+                           qMin(CYAN_PROJECT_TILE_SIZE, width-x),
+                           qMin(CYAN_PROJECT_TILE_SIZE, height-y));
+                bool found = false;
+                for (int i=0;hasSource && i<stored.size() && !found;++i) {
+                    found = stored.at(i).rect == rect;
+                }
+                if (found) { continue; }
+                try {
+                    Magick::Image tile = layer.image;
+                    tile.crop(Magick::Geometry(static_cast<size_t>(rect.width()),
+                                               static_cast<size_t>(rect.height()),
+                                               rect.x(),
+                                               rect.y()));
+                    tile.repage();
+                    (*tiles)[layers.key()].insert(qMakePair(x, y), tile);
+                }
+                catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+                catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+            }
+        }
+
+        // keeps the size, no pixels are allocated
+        Magick::Image placeholder;
+        placeholder.size(Magick::Geometry(static_cast<size_t>(width),
+                                          static_cast<size_t>(height)));
+        layer.image = placeholder;
+    }
+    return result;
+}
+
+bool Project::autosave(Common::Canvas canvas,
+                       Project::Tiles tiles,
+                       const QString &filename,
+                       QThreadPool *pool)
+{
+    // runs on the autosave pool, don't compete with the GUI
+    QThread::currentThread()->setPriority(QThread::LowestPriority);
+
+    // the canvas is a snapshot() with its changed tiles,
+    // they are encoded on the given pool at low priority
+    return write(&canvas,
+                 filename,
+                 Project::FastCodec,
+                 true,
+                 pool,
+                 &tiles);
+}
+
+void Project::markDirty(Common::Layer *layer,
+                        const QRect &rect)
+{
+    if (!layer) { return; }
+    layer->thumbnail = QImage();
+    if (rect.isNull()) {
+        // the image was replaced, tiles still waiting in the project
+        // file are stale and must never be composited over it
+        layer->chunks.clear();
+        layer->saved.clear();
+        return;
+    }
+    for (int i=layer->saved.size()-1;i>=0;--i) {
+        if (layer->saved.at(i).rect.intersects(rect)) { layer->saved.removeAt(i); }
+    }
+}
+
+Common::Canvas Project::read(const QString &filename,
+                             bool lazy)
+{
+    Common::Canvas canvas;
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        canvas.error = file.errorString();
+        return canvas;
+    }
+
+    Project::Header header;
+    if (!readHeader(&file, &header) ||
+        !file.seek(static_cast<qint64>(header.indexOffset)))
+    {
+        canvas.error = QObject::tr("Not a valid project file");
+        return canvas;
+    }
+
+    // only the index is read, tiles are decoded on demand
+    QByteArray index = file.read(static_cast<qint64>(header.indexSize));
+    QDataStream stream(index);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    qint32 width, height, depth, colorspace, layerCount;
+    QByteArray profile;
+    stream >> canvas.label >> width >> height >> depth >> colorspace >> profile >> layerCount;
+    if (stream.status() != QDataStream::Ok || width<1 || height<1) {
+        canvas.error = QObject::tr("Broken project index");
+        return canvas;
+    }
+
+    Magick::ColorspaceType space = static_cast<Magick::ColorspaceType>(colorspace);
+    canvas.image = blankImage(width, height, depth, space);
+    if (profile.size()>0) {
+        canvas.profile = ProfileRegistry::intern(Magick::Blob(profile.constData(),
+                                                              static_cast<size_t>(profile.size())));
+        try { canvas.image.profile("ICC", canvas.profile); }
+        catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    }
+    try { canvas.image.label(canvas.label.toStdString()); }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    canvas.filename = filename;
+
+    for (int i=0;i<layerCount;++i) {
+        qint32 id, layerWidth, layerHeight, composite, chunkCount;
+        Common::Layer layer;
+        stream >> id >> layer.label >> layerWidth >> layerHeight;
+        stream >> layer.pos >> layer.visible >> layer.opacity >> composite >> chunkCount;
+        if (stream.status() != QDataStream::Ok) {
+            canvas.error = QObject::tr("Broken project index");
+            return canvas;
+        }
+        layer.composite = static_cast<Magick::CompositeOperator>(composite);
+        for (int y=0;y<chunkCount;++y) {
+            Common::Chunk chunk;
+            stream >> chunk.rect >> chunk.offset >> chunk.size;
+            layer.chunks.append(chunk);
+        }
+        layer.saved = layer.chunks;
+        layer.image = blankImage(layerWidth, layerHeight, depth, space);
+        try { layer.image.label(layer.label.toStdString()); }
+        catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        if (!lazy) { loadChunks(&layer, filename); }
+        canvas.layers.insert(id, layer);
+    }
+
+    // previews, shown until the tiles are decoded
+    if (!stream.atEnd()) {
+        qint32 thumbCount;
+        stream >> canvas.preview >> thumbCount;
+        for (int i=0;i<thumbCount && stream.status() == QDataStream::Ok;++i) {
+            qint32 id;
+            QImage thumb;
+            stream >> id >> thumb;
+            if (canvas.layers.contains(id)) { canvas.layers[id].thumbnail = thumb; }
+        }
+    }
+    return canvas;
+}
+
+QImage Project::readPreview(const QString &filename)
+{
+    QFile file(filename);
+    Project::Header header;
+    if (!file.open(QIODevice::ReadOnly) ||
+        !readHeader(&file, &header) ||
+        !file.seek(static_cast<qint64>(header.indexOffset))) { return QImage(); }
+    QByteArray index = file.read(static_cast<qint64>(header.indexSize));
+    QDataStream stream(index);
+    stream.setVersion(QDataStream::Qt_5_6);
+    Project::Summary summary;
+    QImage preview;
+    if (readSummary(stream, &summary, true) && !stream.atEnd()) { stream >> preview; }
+    return preview;
+}
+
+Magick::Image Project::readChunk(const QString &filename,
+                                 const Common::Chunk &chunk)
+{
+    Magick::Image image;
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly) ||
+        chunk.size<1 ||
+        chunk.offset+chunk.size>file.size()) { return image; }
+
+    // map the chunk instead of reading it, the OS pages it in on decode
+    uchar *data = file.map(chunk.offset, chunk.size);
+    if (data) {
+        image = decodeChunk(data, chunk.size);
+        file.unmap(data);
+    } else if (file.seek(chunk.offset)) {
+        QByteArray buffer = file.read(chunk.size);
+        image = decodeChunk(reinterpret_cast<const uchar*>(buffer.constData()),
+                            buffer.size());
+    }
+    return image;
+}
+
+Magick::Image Project::readMappedChunk(const uchar *map,
+                                       qint64 length,
+                                       const Common::Chunk &chunk)
+{
+    if (!map ||
+        chunk.size<1 ||
+        chunk.offset<CYAN_PROJECT_HEADER_SIZE ||
+        chunk.offset+chunk.size>length) { return Magick::Image(); }
+    return decodeChunk(map+chunk.offset, chunk.size);
+}
+
+Magick::Image Project::decodeChunk(const uchar *data,
+                                   qint64 size)
+{
+    Magick::Image image;
+    if (!data || size<1) { return image; }
+
+    // read straight from the (mapped) data, a Magick::Blob would copy it
+    MagickCore::ImageInfo *info = MagickCore::AcquireImageInfo();
+    MagickCore::ExceptionInfo *exception = MagickCore::AcquireExceptionInfo();
+    MagickCore::Image *decoded = MagickCore::BlobToImage(info,
+                                                         data,
+                                                         static_cast<size_t>(size),
+                                                         exception);
+    if (exception->severity >= MagickCore::ErrorException) {
+        qWarning() << (exception->reason ? exception->reason : "failed to decode chunk");
+    }
+    if (decoded) { image = Magick::Image(decoded); }
+    MagickCore::DestroyExceptionInfo(exception);
+    MagickCore::DestroyImageInfo(info);
+    return image;
+}
+
+void Project::applyChunk(Common::Layer *layer,
+                         const Common::Chunk &chunk,
+                         Magick::Image pixels)
+{
+    if (!layer) { return; }
+    for (int i=0;i<layer->chunks.size();++i) {
+        if (layer->chunks.at(i).offset != chunk.offset) { continue; }
+        layer->chunks.removeAt(i);
+        if (!pixels.isValid()) { break; }
+        try {
+            layer->image.composite(pixels,
+                                   chunk.rect.x(),
+                                   chunk.rect.y(),
+                                   Magick::CopyCompositeOp);
+        }
+        catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+        break;
+    }
+}
+
+void Project::loadChunks(Common::Layer *layer,
+                         const QString &filename,
+                         const QRect &rect)
+{
+    loadChunks(layer,
+               Project::ChunkReader(filename),
+               rect);
+}
+
+void Project::loadChunks(Common::Layer *layer,
+                         const uchar *map,
+                         qint64 length,
+                         const QRect &rect)
+{
+    loadChunks(layer,
+               Project::ChunkReader(map, length),
+               rect);
+}
+
+void Project::loadChunks(Common::Layer *layer,
+                         const Project::ChunkReader &reader,
+                         const QRect &rect)
+{
+    if (!layer) { return; }
+    QList<Common::Chunk> chunks;
+    for (int i=0;i<layer->chunks.size();++i) {
+        if (!rect.isNull() && !layer->chunks.at(i).rect.intersects(rect)) { continue; }
+        chunks.append(layer->chunks.at(i));
+    }
+    if (chunks.size()==0) { return; }
+
+    // decode in parallel, then copy into the layer
+    QList<Magick::Image> pixels = QtConcurrent::blockingMapped<QList<Magick::Image> >(chunks,
+                                                                                      reader);
+    for (int i=0;i<chunks.size() && i<pixels.size();++i) {
+        applyChunk(layer,
+                   chunks.at(i),
+                   pixels.at(i));
+    }
+}
+
+bool Project::readHeader(QIODevice *device,
+                         Project::Header *header)
+{
+    if (!device || !header) { return false; }
+    QByteArray data = device->read(CYAN_PROJECT_HEADER_SIZE);
+    if (data.size() != CYAN_PROJECT_HEADER_SIZE ||
+        !data.startsWith(CYAN_PROJECT_MAGIC)) { return false; }
+    QDataStream stream(data.mid(8));
+    quint32 reserved;
+    stream >> header->version >> reserved >> header->indexOffset >> header->indexSize;
+    return stream.status() == QDataStream::Ok &&
+           header->version>0 &&
+           header->version<=CYAN_PROJECT_FORMAT;
+}
+
+bool Project::writeHeader(QIODevice *device,
+                          const Project::Header &header)
+{
+    if (!device) { return false; }
+    QByteArray data(CYAN_PROJECT_MAGIC);
+    QDataStream stream(&data, QIODevice::Append);
+    stream << header.version << static_cast<quint32>(0) << header.indexOffset << header.indexSize;
+    return device->write(data) == CYAN_PROJECT_HEADER_SIZE;
+}
+
+bool Project::readSummary(QDataStream &stream,
+                          Project::Summary *summary,
+                          bool index)
+{
+    if (!summary) { return false; }
+    qint32 width, height, depth, colorspace, layerCount, layerEntries;
+    QByteArray profile;
+    stream >> summary->label >> width >> height >> depth >> colorspace;
+    if (index) { stream >> profile; }
+    stream >> layerCount;
+    if (index) { layerEntries = layerCount; }
+    else { stream >> layerEntries; }
+    if (stream.status() != QDataStream::Ok || width<1 || height<1) { return false; }
+    summary->size = QSize(width, height);
+    summary->depth = depth;
+    summary->colorspace = static_cast<Magick::ColorspaceType>(colorspace);
+    summary->layerCount = layerCount;
+    summary->layers.clear();
+
+    for (int i=0;i<layerEntries;++i) {
+        qint32 id, layerWidth, layerHeight;
+        Project::LayerSummary layer;
+        stream >> id >> layer.label >> layerWidth >> layerHeight;
+        if (index) {
+            QSize pos;
+            double opacity;
+            qint32 composite, chunkCount;
+            stream >> pos >> layer.visible >> opacity >> composite >> chunkCount;
+            for (int y=0;y<chunkCount && stream.status() == QDataStream::Ok;++y) {
+                Common::Chunk chunk;
+                stream >> chunk.rect >> chunk.offset >> chunk.size;
+            }
+        } else { stream >> layer.visible; }
+        if (stream.status() != QDataStream::Ok) { return false; }
+        layer.id = id;
+        layer.size = QSize(layerWidth, layerHeight);
+        summary->layers.append(layer);
+    }
+    return true;
+}
+
+bool Project::writeSummary(QIODevice *device,
+                           const Common::Canvas &canvas)
+{
+    if (!device) { return false; }
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << canvas.label;
+    stream << static_cast<qint32>(canvas.image.columns());
+    stream << static_cast<qint32>(canvas.image.rows());
+    stream << static_cast<qint32>(canvas.image.depth());
+    stream << static_cast<qint32>(canvas.image.colorSpace());
+    stream << static_cast<qint32>(canvas.layers.size());
+
+    // as many layers as fits, the rest is in the index
+    QByteArray entries;
+    QDataStream entryStream(&entries, QIODevice::WriteOnly);
+    entryStream.setVersion(QDataStream::Qt_5_6);
+    qint32 entryCount = 0;
+    QMapIterator<int, Common::Layer> layers(canvas.layers);
+    while (layers.hasNext()) {
+        layers.next();
+        QByteArray entry;
+        QDataStream layerStream(&entry, QIODevice::WriteOnly);
+        layerStream.setVersion(QDataStream::Qt_5_6);
+        layerStream << static_cast<qint32>(layers.key());
+        layerStream << layers.value().label;
+        layerStream << static_cast<qint32>(layers.value().image.columns());
+        layerStream << static_cast<qint32>(layers.value().image.rows());
+        layerStream << layers.value().visible;
+        if (data.size()+4+entries.size()+entry.size() > CYAN_PROJECT_SUMMARY_SIZE) { break; }
+        entryStream.writeRawData(entry.constData(), entry.size());
+        entryCount++;
+    }
+    stream << entryCount;
+    stream.writeRawData(entries.constData(), entries.size());
+    if (data.size()>CYAN_PROJECT_SUMMARY_SIZE) { return false; }
+    data.append(QByteArray(CYAN_PROJECT_SUMMARY_SIZE-data.size(), '\0'));
+    return device->write(data) == CYAN_PROJECT_SUMMARY_SIZE;
+}
+
+QByteArray Project::encodeJob(const Project::EncodeJob &job)
+{
+    if (job.stored) { return QByteArray(); }
+
+    // threads of a background pool only ever run background work
+    if (job.background) { QThread::currentThread()->setPriority(QThread::LowestPriority); }
+    return encodeChunk(job.image,
+                       job.cropped ? QRect(QPoint(0, 0), job.rect.size()) : job.rect,
+                       job.codec);
+}
+
+QByteArray Project::encodeChunk(Magick::Image image,
+                                const QRect &rect,
+                                Project::Codec codec)
+{
+    QByteArray data;
+    try {
+        image.crop(Magick::Geometry(static_cast<size_t>(rect.width()),
+                                    static_cast<size_t>(rect.height()),
+                                    rect.x(),
+                                    rect.y()));
+        image.repage();
+        image.strip();
+        image.magick("MIFF");
+        image.compressType(codecCompression(codec));
+        // zlib level and LZMA preset are taken from quality/10
+        image.quality(codec == Project::FastCodec ? 10 : codec == Project::BalancedCodec ? 60 : 90);
+        Magick::Blob blob;
+        image.write(&blob);
+        data = QByteArray(static_cast<const char*>(blob.data()),
+                          static_cast<int>(blob.length()));
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return data;
+}
+
+QImage Project::thumbnail(Magick::Image image,
+                          int size)
+{
+    QImage thumb;
+    try {
+        image.quiet(true);
+        image.depth(8);
+        image.thumbnail(Magick::Geometry(static_cast<size_t>(size),
+                                         static_cast<size_t>(size)));
+        image.magick("PNG");
+        Magick::Blob blob;
+        image.write(&blob);
+        thumb = QImage::fromData(reinterpret_cast<const uchar*>(blob.data()),
+                                 static_cast<int>(blob.length()));
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return thumb;
+}
+
+QImage Project::renderPreview(const Common::Canvas &canvas)
+{
+    // comp downscaled layers, not the full resolution canvas
+    size_t width = canvas.image.columns();
+    size_t height = canvas.image.rows();
+    if (width<1 || height<1) { return QImage(); }
+    double scale = qMin(1.0, static_cast<double>(CYAN_PROJECT_PREVIEW_SIZE)/qMax(width, height));
+
+    Magick::Image background = canvas.image;
+    QMap<int, Common::Layer> scaled;
+    try {
+        background.quiet(true);
+        background.scale(Magick::Geometry(qMax<size_t>(1, static_cast<size_t>(width*scale)),
+                                          qMax<size_t>(1, static_cast<size_t>(height*scale))));
+        QMapIterator<int, Common::Layer> layers(canvas.layers);
+        while (layers.hasNext()) {
+            layers.next();
+            if (!layers.value().visible) { continue; }
+            Common::Layer layer = layers.value();
+            layer.image.quiet(true);
+            layer.image.scale(Magick::Geometry(qMax<size_t>(1, static_cast<size_t>(layer.image.columns()*scale)),
+                                               qMax<size_t>(1, static_cast<size_t>(layer.image.rows()*scale))));
+            layer.pos = QSize(static_cast<int>(layer.pos.width()*scale),
+                              static_cast<int>(layer.pos.height()*scale));
+            scaled.insert(layers.key(), layer);
+        }
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return thumbnail(Common::compLayers(background, scaled),
+                     CYAN_PROJECT_PREVIEW_SIZE);
+}
+
+Magick::Image Project::blankImage(int width,
+                                  int height,
+                                  int depth,
+                                  Magick::ColorspaceType colorspace)
+{
+    Magick::Image image;
+    try {
+        image.size(Magick::Geometry(static_cast<size_t>(width),
+                                    static_cast<size_t>(height)));
+        image.depth(static_cast<size_t>(depth));
+        image.colorSpace(colorspace);
+        // a single pass over the pixels, enables and clears alpha
+        image.alphaChannel(Magick::TransparentAlphaChannel);
+    }
+    catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+    return image;
+}
@@ -0,0 +1,214 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include <QString>
+#include <QIODevice>
+#include <QDataStream>
+#include <QSize>
+#include <QMap>
+#include <QPair>
+#include <QThreadPool>
+
+#include "common.h"
+
+#define CYAN_PROJECT_MAGIC "CYANPROJ"
+#define CYAN_PROJECT_FORMAT 2
+#define CYAN_PROJECT_SUFFIX "cyan"
+#define CYAN_PROJECT_HEADER_SIZE 32
+#define CYAN_PROJECT_SUMMARY_SIZE 4096
+#define CYAN_PROJECT_TILE_SIZE 512
+#define CYAN_PROJECT_COMPACT_RATIO 2
+#define CYAN_PROJECT_COMPACT_MIN 67108864
+#define CYAN_PROJECT_AUTOSAVE 5
+#define CYAN_PROJECT_PREVIEW_SIZE 256
+#define CYAN_PROJECT_THUMB_SIZE 32
+#define CYAN_PROJECT_BENCHMARK_TILES 64
+
+class Project
+{
+public:
+
+    enum Codec
+    {
+        FastCodec,
+        BalancedCodec,
+        ArchiveCodec
+    };
+
+    struct CodecResult
+    {
+        Project::Codec codec = Project::BalancedCodec;
+        qint64 rawBytes = 0;
+        qint64 bytes = 0;
+        qint64 msecs = 0;
+    };
+
+    struct Header
+    {
+        quint32 version = 0;
+        quint64 indexOffset = 0;
+        quint64 indexSize = 0;
+    };
+
+    struct LayerSummary
+    {
+        int id = 0;
+        QString label;
+        QSize size;
+        bool visible = true;
+    };
+
+    // what's known about a project without touching the tiles,
+    // stored right after the header (format 2)
+    struct Summary
+    {
+        quint32 version = 0;
+        QString label;
+        QSize size;
+        int depth = 0;
+        Magick::ColorspaceType colorspace = Magick::UndefinedColorspace;
+        int layerCount = 0;
+        QList<Project::LayerSummary> layers;
+    };
+
+    // copied tiles of a snapshot, by layer and tile origin
+    typedef QMap<int, QMap<QPair<int, int>, Magick::Image> > Tiles;
+
+    static bool isProject(const QString &filename);
+    static bool probe(const QString &filename,
+                      Project::Summary *summary = nullptr);
+
+    static bool write(Common::Canvas *canvas,
+                      const QString &filename,
+                      Project::Codec codec = Project::BalancedCodec,
+                      bool compact = false,
+                      QThreadPool *pool = nullptr,
+                      const Project::Tiles *tiles = nullptr);
+    static bool needsCompaction(const Common::Canvas &canvas);
+    static Common::Canvas compact(Common::Canvas canvas);
+    static bool commitCompaction(const QString &filename);
+    static void markDirty(Common::Layer *layer,
+                          const QRect &rect = QRect());
+
+    static const QString codecName(Project::Codec codec);
+    static Magick::CompressionType codecCompression(Project::Codec codec);
+    static QList<Project::CodecResult> benchmark(Common::Canvas canvas);
+
+    static const QString autosavePath();
+    static const QString autosavePath(qint64 pid);
+    static const QString autosaveLockFile(qint64 pid);
+    static Common::Canvas snapshot(const Common::Canvas &canvas,
+                                   Project::Tiles *tiles);
+    static bool autosave(Common::Canvas canvas,
+                         Project::Tiles tiles,
+                         const QString &filename,
+                         QThreadPool *pool);
+    static Common::Canvas read(const QString &filename,
+                               bool lazy = true);
+    static QImage readPreview(const QString &filename);
+
+    static Magick::Image readChunk(const QString &filename,
+                                   const Common::Chunk &chunk);
+    static Magick::Image readMappedChunk(const uchar *map,
+                                         qint64 length,
+                                         const Common::Chunk &chunk);
+    static Magick::Image decodeChunk(const uchar *data,
+                                     qint64 size);
+    static void applyChunk(Common::Layer *layer,
+                           const Common::Chunk &chunk,
+                           Magick::Image pixels);
+    static void loadChunks(Common::Layer *layer,
+                           const QString &filename,
+                           const QRect &rect = QRect());
+    static void loadChunks(Common::Layer *layer,
+                           const uchar *map,
+                           qint64 length,
+                           const QRect &rect = QRect());
+    static Magick::Image blankImage(int width,
+                                    int height,
+                                    int depth,
+                                    Magick::ColorspaceType colorspace);
+
+private:
+
+    struct EncodeJob
+    {
+        Magick::Image image;
+        QRect rect;
+        Project::Codec codec = Project::BalancedCodec;
+        bool stored = false;
+        bool background = false;
+        bool cropped = false; // image is the tile itself
+        Common::Chunk chunk;
+    };
+
+    struct ChunkReader
+    {
+        explicit ChunkReader(const QString &filename) : filename(filename), map(nullptr), length(0) {}
+        explicit ChunkReader(const uchar *map, qint64 length) : map(map), length(length) {}
+        typedef Magick::Image result_type;
+        Magick::Image operator()(const Common::Chunk &chunk) const
+        {
+            if (map) { return Project::readMappedChunk(map, length, chunk); }
+            return Project::readChunk(filename, chunk);
+        }
+        QString filename;
+        const uchar *map;
+        qint64 length;
+    };
+
+    static void loadChunks(Common::Layer *layer,
+                           const Project::ChunkReader &reader,
+                           const QRect &rect);
+
+    static QByteArray encodeJob(const Project::EncodeJob &job);
+    static bool readHeader(QIODevice *device,
+                           Project::Header *header);
+    static bool writeHeader(QIODevice *device,
+                            const Project::Header &header);
+    static bool readSummary(QDataStream &stream,
+                            Project::Summary *summary,
+                            bool index);
+    static bool writeSummary(QIODevice *device,
+                             const Common::Canvas &canvas);
+    static QByteArray encodeChunk(Magick::Image image,
+                                  const QRect &rect,
+                                  Project::Codec codec);
+    static QImage thumbnail(Magick::Image image,
+                            int size);
+    static QImage renderPreview(const Common::Canvas &canvas);
+};
+
+#endif // PROJECT_H
@@ -0,0 +1,272 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "render.h"
+#include "project.h"
+#include "bandwriter.h"
+#include "sniffer.h"
+#include "colorengine.h"
+#include "profileregistry.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+#include <QDebug>
+
+bool Render::isRender(int argc,
+                      char *argv[])
+{
+    for (int i=1;i<argc;++i) {
+        if (qstrcmp(argv[i], "--render") == 0) { return true; }
+    }
+    return false;
+}
+
+int Render::exec(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QObject::tr("Render Cyan projects without a display."));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument(QString("files"),
+                                 QObject::tr("Projects to render."),
+                                 QString("[files...]"));
+    QCommandLineOption renderOption(QString("render"),
+                                    QObject::tr("Render projects and exit."));
+    QCommandLineOption outOption(QString("out"),
+                                 QObject::tr("Output file, or folder when rendering several projects."),
+                                 QString("path"));
+    QCommandLineOption profileOption(QString("profile"),
+                                     QObject::tr("Convert the rendered image to this ICC profile."),
+                                     QString("icc"));
+    QCommandLineOption threadsOption(QString("threads"),
+                                     QObject::tr("Number of projects rendered at the same time."),
+                                     QString("N"),
+                                     QString::number(qMax(1, QThread::idealThreadCount())));
+    parser.addOption(renderOption);
+    parser.addOption(outOption);
+    parser.addOption(profileOption);
+    parser.addOption(threadsOption);
+    parser.process(args);
+
+    QStringList inputs = parser.positionalArguments();
+    if (inputs.isEmpty()) {
+        print(QObject::tr("No projects to render"), true);
+        return 1;
+    }
+
+    // several inputs always go to a folder
+    QString output = parser.value(outOption);
+    bool folder = false;
+    if (!output.isEmpty()) {
+        folder = inputs.size()>1 ||
+                 QFileInfo(output).isDir() ||
+                 output.endsWith(QDir::separator()) ||
+                 output.endsWith(QString("/"));
+        if (folder && !QDir().mkpath(output)) {
+            print(QObject::tr("Unable to create output folder %1").arg(output), true);
+            return 1;
+        }
+    }
+
+    // read the target profile once, every layer is converted with it
+    Magick::Blob profile;
+    if (parser.isSet(profileOption)) {
+        profile = ProfileRegistry::blob(parser.value(profileOption));
+        if (profile.length()==0) {
+            print(QObject::tr("Unable to read profile %1")
+                  .arg(parser.value(profileOption)), true);
+            return 1;
+        }
+    }
+
+    bool validThreads = false;
+    int threads = parser.value(threadsOption).toInt(&validThreads);
+    if (!validThreads || threads<1) {
+        print(QObject::tr("Invalid thread count %1")
+              .arg(parser.value(threadsOption)), true);
+        return 1;
+    }
+
+    // parallelism is per project, keep each render single threaded
+    // so N projects don't fight over N*cores OpenMP threads
+    if (threads>1) { Magick::ResourceLimits::thread(1); }
+
+    // inputs sharing a basename would overwrite each other's output,
+    // refuse before anything is rendered
+    QList<Render::Job> jobs;
+    QMap<QString, QString> outputs;
+    for (int i=0;i<inputs.size();++i) {
+        Render::Job job;
+        job.input = inputs.at(i);
+        job.output = outputFilename(job.input, output, folder);
+        job.profile = profile;
+        QString key = QFileInfo(job.output).absoluteFilePath();
+        if (key == QFileInfo(job.input).absoluteFilePath()) {
+            print(QObject::tr("%1 would be overwritten by its own output")
+                  .arg(job.input), true);
+            return 1;
+        }
+        if (outputs.contains(key)) {
+            print(QObject::tr("%1 and %2 would both be rendered to %3")
+                  .arg(outputs.value(key))
+                  .arg(job.input)
+                  .arg(job.output), true);
+            return 1;
+        }
+        outputs[key] = job.input;
+        jobs << job;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<QFuture<Render::Result> > futures;
+    for (int i=0;i<jobs.size();++i) {
+        futures << QtConcurrent::run(&pool, Render::renderFile, jobs.at(i));
+    }
+
+    int failed = 0;
+    for (int i=0;i<futures.size();++i) {
+        Render::Result result = futures[i].result();
+        if (!result.error.isEmpty()) { failed++; }
+    }
+
+    print(QObject::tr("Rendered %1 of %2 projects in %3 ms")
+          .arg(inputs.size()-failed)
+          .arg(inputs.size())
+          .arg(timer.elapsed()), failed>0);
+
+    return failed>0?1:0;
+}
+
+Render::Result Render::renderFile(const Render::Job &job)
+{
+    Render::Result result;
+    result.input = job.input;
+    result.output = job.output;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    Common::Canvas canvas = readFile(job.input);
+    if (canvas.error.isEmpty() && BandWriter::supports(job.output)) {
+        // converted per band while streaming to disk
+        if (!BandWriter::write(canvas, job.output, job.profile)) {
+            canvas.error = QObject::tr("Unable to write %1").arg(job.output);
+        }
+    } else if (canvas.error.isEmpty()) {
+        if (job.profile.length()>0) {
+            canvas = ColorEngine::convertCanvas(canvas, job.profile);
+        }
+        if (!Common::renderCanvasToFile(canvas, job.output)) {
+            canvas.error = QObject::tr("Unable to write %1").arg(job.output);
+        }
+    }
+
+    result.error = canvas.error;
+    result.msecs = timer.elapsed();
+
+    if (result.error.isEmpty()) {
+        print(QString("%1 -> %2 (%3 ms)")
+              .arg(result.input)
+              .arg(result.output)
+              .arg(result.msecs));
+    } else {
+        print(QString("%1: %2 (%3 ms)")
+              .arg(result.input)
+              .arg(result.error)
+              .arg(result.msecs), true);
+    }
+    return result;
+}
+
+const QString Render::outputFilename(const QString &input,
+                                     const QString &output,
+                                     bool folder)
+{
+    QFileInfo fileInfo(input);
+    QString filename = QString("%1.tif").arg(fileInfo.completeBaseName());
+    if (output.isEmpty()) {
+        return QString("%1/%2").arg(fileInfo.absolutePath()).arg(filename);
+    }
+    if (folder) { return QDir(output).filePath(filename); }
+    return output;
+}
+
+Common::Canvas Render::readFile(const QString &filename)
+{
+    Common::Canvas canvas;
+    if (!QFileInfo::exists(filename)) {
+        canvas.error = QObject::tr("File does not exist");
+        return canvas;
+    }
+
+    // no view to page in tiles, load everything up front
+    Sniffer::FileType type = Sniffer::classify(filename).type;
+    if (type == Sniffer::ProjectFile) {
+        canvas = Project::read(filename, false);
+    } else if (type == Sniffer::CanvasFile) {
+        canvas = Common::readCanvas(filename);
+    } else {
+        canvas.error = QObject::tr("Not a Cyan project");
+        return canvas;
+    }
+
+    if (canvas.error.isEmpty() && canvas.layers.size()==0) {
+        canvas.error = QObject::tr("Project has no layers");
+    }
+    return canvas;
+}
+
+void Render::print(const QString &message,
+                   bool error)
+{
+    // workers report as they finish, keep lines whole
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    QTextStream stream(error?stderr:stdout);
+    stream << message << "\n";
+    stream.flush();
+}
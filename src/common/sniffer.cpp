@@ -0,0 +1,131 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "sniffer.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QMutexLocker>
+
+QMutex Sniffer::_mutex;
+QCache<QString, Sniffer::Entry> Sniffer::_cache(SNIFFER_CACHE_MAX);
+
+Sniffer::Result Sniffer::classify(const QString &filename)
+{
+    Sniffer::Result result;
+    if (filename.isEmpty()) { return result; }
+    QFileInfo info(filename);
+    if (!info.isFile()) { return result; }
+
+    // a stat is enough to tell if the cached result is still valid
+    QString key = info.absoluteFilePath();
+    qint64 size = info.size();
+    QDateTime modified = info.lastModified();
+    {
+        QMutexLocker lock(&_mutex);
+        Sniffer::Entry *entry = _cache.object(key);
+        if (entry &&
+            entry->size == size &&
+            entry->modified == modified) { return entry->result; }
+    }
+
+    result = sniff(key);
+
+    QMutexLocker lock(&_mutex);
+    _cache.insert(key, new Sniffer::Entry{size, modified, result});
+    return result;
+}
+
+bool Sniffer::hasMedia(const QList<QUrl> &urls)
+{
+    for (int i=0;i<urls.size();++i) {
+        if (!urls.at(i).isLocalFile()) { continue; }
+        if (classify(urls.at(i).toLocalFile()).type != UnknownFile) { return true; }
+    }
+    return false;
+}
+
+void Sniffer::clear()
+{
+    QMutexLocker lock(&_mutex);
+    _cache.clear();
+}
+
+Sniffer::Result Sniffer::sniff(const QString &filename)
+{
+    Sniffer::Result result;
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) { return result; }
+    QByteArray header = file.read(SNIFFER_HEADER_SIZE);
+    if (header.isEmpty()) { return result; }
+
+    // projects, the summary is kept for the status bar and layer count
+    if (header.startsWith(CYAN_PROJECT_MAGIC)) {
+        file.close();
+        if (Project::probe(filename, &result.summary)) {
+            result.type = ProjectFile;
+            result.mime = QString("application/x-cyan-project");
+        }
+        return result;
+    }
+
+    // legacy projects are MIFF with our attribute in the text header
+    if (header.startsWith("id=ImageMagick")) {
+        while (!header.contains(":\x1a") &&
+               header.size()<SNIFFER_MIFF_HEADER_MAX &&
+               !file.atEnd()) { header.append(file.read(SNIFFER_HEADER_SIZE)); }
+        int end = header.indexOf(":\x1a");
+        if (end>=0) { header.truncate(end); }
+        result.type = header.contains(QByteArray(CYAN_PROJECT).append('=')) ? CanvasFile : RasterFile;
+        result.mime = QString("image/miff");
+        return result;
+    }
+
+    // everything else by name and content, using the bytes we already have
+    QMimeDatabase db;
+    result.mime = db.mimeTypeForFileNameAndData(filename, header).name();
+    if (result.mime.startsWith(QString("audio"))) {
+        result.type = AudioFile;
+    } else if (result.mime.startsWith(QString("video"))) {
+        result.type = VideoFile;
+    } else if (header.startsWith("8BPS") || header.startsWith("gimp xcf")) {
+        result.type = LayeredFile;
+    } else if (result.mime.startsWith(QString("image")) ||
+               Common::supportedReadFormats()
+               .split(QChar(' '))
+               .contains(QString("*.%1").arg(QFileInfo(filename).suffix().toLower())))
+    {
+        result.type = RasterFile;
+    }
+    return result;
+}
@@ -0,0 +1,232 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "transformcache.h"
+#include "profileregistry.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+QMutex TransformCache::_mutex;
+QMap<QByteArray, TransformCache::Transform> TransformCache::_transforms;
+QList<QByteArray> TransformCache::_order;
+
+TransformCache::Transform TransformCache::getTransform(const Magick::Blob &input,
+                                           const Magick::Blob &output,
+                                           cmsUInt32Number inputFormat,
+                                           cmsUInt32Number outputFormat,
+                                           Common::RenderingIntent intent,
+                                           bool blackpoint,
+                                           cmsUInt32Number flags)
+{
+    if (blackpoint) { flags |= cmsFLAGS_BLACKPOINTCOMPENSATION; }
+
+    QByteArray key = profileHash(input);
+    key.append(profileHash(output));
+    key.append(QByteArray::number(inputFormat));
+    key.append(':');
+    key.append(QByteArray::number(outputFormat));
+    key.append(':');
+    key.append(QByteArray::number(lcmsIntent(intent)));
+    key.append(':');
+    key.append(QByteArray::number(flags));
+
+    QMutexLocker lock(&_mutex);
+    if (_transforms.contains(key)) {
+        _order.removeOne(key);
+        _order.append(key);
+        return _transforms.value(key);
+    }
+
+    cmsHPROFILE inputProfile = openProfile(input);
+    cmsHPROFILE outputProfile = openProfile(output);
+    cmsHTRANSFORM transform = nullptr;
+    if (inputProfile && outputProfile) {
+        transform = cmsCreateTransform(inputProfile,
+                                       inputFormat,
+                                       outputProfile,
+                                       outputFormat,
+                                       lcmsIntent(intent),
+                                       flags);
+    }
+    if (inputProfile) { cmsCloseProfile(inputProfile); }
+    if (outputProfile) { cmsCloseProfile(outputProfile); }
+    if (!transform) {
+        qWarning() << "failed to create color transform";
+        return TransformCache::Transform();
+    }
+
+    // drop the least recently used, deleted once the last user is done
+    while (_order.size()>=TRANSFORM_CACHE_MAX) {
+        _transforms.remove(_order.takeFirst());
+    }
+    TransformCache::Transform shared(transform, cmsDeleteTransform);
+    _transforms[key] = shared;
+    _order.append(key);
+    return shared;
+}
+
+void TransformCache::clear()
+{
+    QMutexLocker lock(&_mutex);
+    _transforms.clear();
+    _order.clear();
+}
+
+QVector<double> TransformCache::convertColor(const QColor &color,
+                                             const Magick::Blob &input,
+                                             const Magick::Blob &output,
+                                             Common::RenderingIntent intent,
+                                             bool blackpoint)
+{
+    // the registry keeps the profile open, nothing is parsed per color
+    QVector<double> result;
+    cmsColorSpaceSignature signature = profileColorspace(output);
+
+    cmsUInt32Number outputFormat;
+    int channels;
+    switch (signature) {
+    case cmsSigCmykData:
+        outputFormat = TYPE_CMYK_DBL;
+        channels = 4;
+        break;
+    case cmsSigGrayData:
+        outputFormat = TYPE_GRAY_DBL;
+        channels = 1;
+        break;
+    case cmsSigRgbData:
+        outputFormat = TYPE_RGB_DBL;
+        channels = 3;
+        break;
+    default:
+        return result;
+    }
+
+    TransformCache::Transform transform = getTransform(input,
+                                                       output,
+                                                       TYPE_RGB_DBL,
+                                                       outputFormat,
+                                                       intent,
+                                                       blackpoint);
+    if (!transform) { return result; }
+
+    double rgb[3] = { color.redF(), color.greenF(), color.blueF() };
+    double values[4] = { 0.0, 0.0, 0.0, 0.0 };
+    cmsDoTransform(transform.data(), rgb, values, 1);
+
+    // lcms uses 0-100 for floating point CMYK
+    for (int i=0;i<channels;++i) {
+        double value = signature == cmsSigCmykData ? values[i]/100.0 : values[i];
+        result.append(qBound(0.0, value, 1.0));
+    }
+    return result;
+}
+
+Magick::Color TransformCache::convertColorNative(const QColor &color,
+                                                 const Magick::Blob &input,
+                                                 const Magick::Blob &output,
+                                                 Magick::ColorspaceType colorspace,
+                                                 Common::RenderingIntent intent,
+                                                 bool blackpoint)
+{
+    QVector<double> values = convertColor(color,
+                                          input,
+                                          output,
+                                          intent,
+                                          blackpoint);
+    switch (colorspace) {
+    case Magick::CMYKColorspace:
+        if (values.size()==4) {
+            return Magick::ColorCMYK(values.at(0),
+                                     values.at(1),
+                                     values.at(2),
+                                     values.at(3),
+                                     color.alphaF());
+        }
+        // no usable profile, naive conversion
+        return Magick::ColorCMYK(color.cyanF(),
+                                 color.magentaF(),
+                                 color.yellowF(),
+                                 color.blackF(),
+                                 color.alphaF());
+    case Magick::GRAYColorspace:
+        if (values.size()==1) { return Magick::ColorGray(values.at(0)); }
+        return Magick::ColorGray(qGray(color.rgb())/255.0);
+    default:;
+    }
+    if (values.size()==3) {
+        return Magick::ColorRGB(values.at(0),
+                                values.at(1),
+                                values.at(2),
+                                color.alphaF());
+    }
+    return Magick::ColorRGB(color.redF(),
+                            color.greenF(),
+                            color.blueF(),
+                            color.alphaF());
+}
+
+const QByteArray TransformCache::profileHash(const Magick::Blob &profile)
+{
+    if (profile.length()==0) { return QByteArray("srgb"); }
+    return ProfileRegistry::hash(profile);
+}
+
+cmsUInt32Number TransformCache::lcmsIntent(Common::RenderingIntent intent)
+{
+    switch (intent) {
+    case Common::SaturationRenderingIntent:
+        return INTENT_SATURATION;
+    case Common::AbsoluteRenderingIntent:
+        return INTENT_ABSOLUTE_COLORIMETRIC;
+    case Common::RelativeRenderingIntent:
+        return INTENT_RELATIVE_COLORIMETRIC;
+    default:;
+    }
+    return INTENT_PERCEPTUAL;
+}
+
+cmsHPROFILE TransformCache::openProfile(const Magick::Blob &profile)
+{
+    // use the built-in sRGB when no profile is available
+    if (profile.length()==0) { return cmsCreate_sRGBProfile(); }
+    return cmsOpenProfileFromMem(profile.data(),
+                                 static_cast<cmsUInt32Number>(profile.length()));
+}
+
+cmsColorSpaceSignature TransformCache::profileColorspace(const Magick::Blob &profile)
+{
+    if (profile.length()==0) { return cmsSigRgbData; } // built-in sRGB
+    ProfileRegistry::Handle handle = ProfileRegistry::fromBlob(profile);
+    if (!handle) { return cmsSigXYZData; }
+    return cmsGetColorSpace(handle->handle);
+}
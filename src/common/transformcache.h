@@ -0,0 +1,91 @@
+/*
+# Copyright Ole-André Rodlie.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef TRANSFORMCACHE_H
+#define TRANSFORMCACHE_H
+
+#include <QMap>
+#include <QMutex>
+#include <QByteArray>
+#include <QColor>
+#include <QVector>
+#include <QSharedPointer>
+
+#include <lcms2.h>
+#include <Magick++.h>
+
+#include "common.h"
+
+#define TRANSFORM_CACHE_MAX 32
+
+class TransformCache
+{
+public:
+
+    // shared so an evicted transform stays alive while still in use
+    typedef QSharedPointer<void> Transform;
+
+    static TransformCache::Transform getTransform(const Magick::Blob &input,
+                                      const Magick::Blob &output,
+                                      cmsUInt32Number inputFormat,
+                                      cmsUInt32Number outputFormat,
+                                      Common::RenderingIntent intent = Common::PerceptualRenderingIntent,
+                                      bool blackpoint = true,
+                                      cmsUInt32Number flags = 0);
+    static void clear();
+
+    static QVector<double> convertColor(const QColor &color,
+                                        const Magick::Blob &input,
+                                        const Magick::Blob &output,
+                                        Common::RenderingIntent intent = Common::PerceptualRenderingIntent,
+                                        bool blackpoint = true);
+    static Magick::Color convertColorNative(const QColor &color,
+                                            const Magick::Blob &input,
+                                            const Magick::Blob &output,
+                                            Magick::ColorspaceType colorspace,
+                                            Common::RenderingIntent intent = Common::PerceptualRenderingIntent,
+                                            bool blackpoint = true);
+
+    static const QByteArray profileHash(const Magick::Blob &profile);
+    static cmsUInt32Number lcmsIntent(Common::RenderingIntent intent);
+    static cmsColorSpaceSignature profileColorspace(const Magick::Blob &profile);
+
+private:
+
+    static QMutex _mutex;
+    static QMap<QByteArray, TransformCache::Transform> _transforms;
+    static QList<QByteArray> _order;
+
+    static cmsHPROFILE openProfile(const Magick::Blob &profile);
+};
+
+#endif // TRANSFORMCACHE_H
@@ -40,6 +40,8 @@
 #include <QDebug>
 #include <QSettings>
 
+#include "profileregistry.h"
+
 NewMediaDialog::NewMediaDialog(QWidget *parent,
                                QString title,
                                Common::newDialogType dialogType,
@@ -262,16 +264,5 @@ Magick::Blob NewMediaDialog::selectedProfile()
         return _forcedProfile;
     }
     qDebug() << "selected profile" << filename;
-    if (!filename.isEmpty()) {
-        try {
-            Magick::Image image;
-            image.read(filename.toStdString());
-            Magick::Blob profile;
-            image.write(&profile);
-            return profile;
-        }
-        catch(Magick::Error &error_ ) { qWarning() << error_.what(); }
-        catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
-    }
-    return Magick::Blob();
+    return ProfileRegistry::blob(filename);
 }
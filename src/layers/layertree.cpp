@@ -36,6 +36,7 @@
 #include <QLayout>
 #include <QHeaderView>
 #include <QIcon>
+#include <QPainter>
 
 LayerTreeItem::LayerTreeItem(QTreeWidget *parent) :
     QTreeWidgetItem(parent)
@@ -161,27 +162,39 @@ void LayerTree::populateTree(View *image)
     for (int i=0;i<image->getLayerCount();++i) {
         LayerTreeItem *item = new LayerTreeItem(this);
         blockSignals(true);
-        Magick::Image thumb(Magick::Geometry(32, 32), Magick::ColorRGB(0, 0, 0));
-        thumb.depth(8);
-        thumb.alpha(false);
-        Magick::Image layer = image->getLayer(i).image;
-        layer.depth(8);
-        layer.alpha(false);
-        layer.scale(Magick::Geometry(32, 32));
-        size_t offX = 0;
-        size_t offY = 0;
-        if (layer.columns()<thumb.columns()) {
-            offX = (thumb.columns()-layer.columns())/2;
+        QPixmap pixmap;
+        Common::Layer source = image->getLayer(i);
+        if (!source.thumbnail.isNull()) { // stored in the project, no need to scale the layer
+            pixmap = QPixmap(32, 32);
+            pixmap.fill(Qt::black);
+            QPainter painter(&pixmap);
+            QImage stored = source.thumbnail.scaled(32, 32, Qt::KeepAspectRatio);
+            painter.drawImage((32-stored.width())/2,
+                              (32-stored.height())/2,
+                              stored);
+        } else {
+            Magick::Image thumb(Magick::Geometry(32, 32), Magick::ColorRGB(0, 0, 0));
+            thumb.depth(8);
+            thumb.alpha(false);
+            Magick::Image layer = source.image;
+            layer.depth(8);
+            layer.alpha(false);
+            layer.scale(Magick::Geometry(32, 32));
+            size_t offX = 0;
+            size_t offY = 0;
+            if (layer.columns()<thumb.columns()) {
+                offX = (thumb.columns()-layer.columns())/2;
+            }
+            if (layer.rows()<thumb.rows()) {
+                offY = (thumb.rows()-layer.rows())/2;
+            }
+            thumb.composite(layer, offX, offY, Magick::OverCompositeOp);
+            thumb.magick("BMP");
+            Magick::Blob pix;
+            thumb.write(&pix);
+            pixmap = QPixmap::fromImage(QImage::fromData(reinterpret_cast<uchar*>(const_cast<void*>(pix.data())),
+                                                                                   static_cast<int>(pix.length())));
         }
-        if (layer.rows()<thumb.rows()) {
-            offY = (thumb.rows()-layer.rows())/2;
-        }
-        thumb.composite(layer, offX, offY, Magick::OverCompositeOp);
-        thumb.magick("BMP");
-        Magick::Blob pix;
-        thumb.write(&pix);
-        QPixmap pixmap = QPixmap::fromImage(QImage::fromData(reinterpret_cast<uchar*>(const_cast<void*>(pix.data())),
-                                                                                      static_cast<int>(pix.length())));
         item->setIconSize(QSize(32, 32));
         item->setIcon(2,QIcon(pixmap));
 
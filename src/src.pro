@@ -48,8 +48,20 @@ SOURCES += \
     canvas/view.cpp \
     canvas/layeritem.cpp \
     canvas/tileitem.cpp \
+    canvas/stroke.cpp \
     common/common.cpp \
     common/mdi.cpp \
+    common/history.cpp \
+    common/transformcache.cpp \
+    common/project.cpp \
+    common/importer.cpp \
+    common/render.cpp \
+    common/bandwriter.cpp \
+    common/sniffer.cpp \
+    common/colorengine.cpp \
+    common/displaylut.cpp \
+    common/profilecatalog.cpp \
+    common/profileregistry.cpp \
     colors/qtcolorpicker.cpp \
     colors/qtcolortriangle.cpp \
     colors/colorrgb.cpp \
@@ -65,8 +77,20 @@ HEADERS += \
     canvas/view.h \
     canvas/layeritem.h \
     canvas/tileitem.h \
+    canvas/stroke.h \
     common/common.h \
     common/mdi.h \
+    common/history.h \
+    common/transformcache.h \
+    common/project.h \
+    common/importer.h \
+    common/render.h \
+    common/bandwriter.h \
+    common/sniffer.h \
+    common/colorengine.h \
+    common/displaylut.h \
+    common/profilecatalog.h \
+    common/profileregistry.h \
     colors/qtcolorpicker.h \
     colors/qtcolortriangle.h \
     colors/colorrgb.h \